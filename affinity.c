@@ -0,0 +1,258 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+/* For pthread_attr_setaffinity_np() and syscall() */
+#define _GNU_SOURCE
+#include "bench.h"
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* From <numaif.h>, without linking libnuma */
+#define kMpolInterleave 3
+#define kMpolLocal 4
+#define kMaxNodes 64
+#define kMaxCpus 1024
+
+/* CPU that thread slot i is pinned to is cpus_[i % num_cpus_] */
+static int cpus_[kMaxCpus];
+static int num_cpus_;
+static int num_nodes_;
+static bool numa_applied_;
+
+static int parse_cpu_list(const char*, int*, int);
+static int node_cpus(int, int*, int);
+static void affinity_plan(void);
+static void numa_apply(void);
+
+/*
+ * Parse a list such as "0,2,4-7" into cpus, return the number parsed.
+ */
+static int parse_cpu_list(const char* list, int* cpus, int max) {
+  int n = 0;
+  const char* p = list;
+
+  while (*p != '\0' && *p != '\n' && n < max) {
+    char* end;
+    long lo = strtol(p, &end, 10);
+    long hi = lo;
+    if (end == p) {
+      return -1;
+    }
+    if (*end == '-') {
+      p = end + 1;
+      hi = strtol(p, &end, 10);
+      if (end == p || hi < lo) {
+        return -1;
+      }
+    }
+    for (long c = lo; c <= hi && n < max; c++) {
+      cpus[n++] = (int)c;
+    }
+    p = *end == ',' ? end + 1 : end;
+  }
+
+  return n;
+}
+
+/*
+ * CPUs of NUMA node `node`, or -1 if the node does not exist.
+ */
+static int node_cpus(int node, int* cpus, int max) {
+  char path[100];
+  char line[4096];
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+           node);
+
+  FILE* f = fopen(path, "r");
+  if (f == NULL) {
+    return -1;
+  }
+  int n = 0;
+  if (fgets(line, sizeof(line), f) != NULL) {
+    n = parse_cpu_list(line, cpus, max);
+  }
+  fclose(f);
+
+  return n < 0 ? 0 : n;
+}
+
+/*
+ * "compact" fills one node before moving to the next, "scatter" deals
+ * threads round-robin over the nodes, anything else is an explicit list.
+ * Only CPUs this process may run on, per sched_getaffinity(), are used.
+ */
+static void affinity_plan() {
+  static int by_node[kMaxNodes][kMaxCpus];
+  int per_node[kMaxNodes];
+
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    /* Unknown, assume every online CPU */
+    CPU_ZERO(&allowed);
+    for (int c = 0; c < sysconf(_SC_NPROCESSORS_ONLN) && c < CPU_SETSIZE;
+         c++) {
+      CPU_SET(c, &allowed);
+    }
+  }
+
+  num_nodes_ = 0;
+  while (num_nodes_ < kMaxNodes) {
+    int cpus[kMaxCpus];
+    int n = node_cpus(num_nodes_, cpus, kMaxCpus);
+    if (n < 0) {
+      break;
+    }
+    per_node[num_nodes_] = 0;
+    for (int i = 0; i < n; i++) {
+      if (cpus[i] < CPU_SETSIZE && CPU_ISSET(cpus[i], &allowed)) {
+        by_node[num_nodes_][per_node[num_nodes_]++] = cpus[i];
+      }
+    }
+    num_nodes_++;
+  }
+  if (num_nodes_ == 0) {
+    /* No NUMA information, treat the machine as a single node */
+    num_nodes_ = 1;
+    per_node[0] = 0;
+    for (int c = 0; c < CPU_SETSIZE && per_node[0] < kMaxCpus; c++) {
+      if (CPU_ISSET(c, &allowed)) {
+        by_node[0][per_node[0]++] = c;
+      }
+    }
+  }
+
+  if (FLAGS_cpu_affinity == NULL) {
+    num_cpus_ = 0;
+  } else if (!strcmp(FLAGS_cpu_affinity, "compact")) {
+    num_cpus_ = 0;
+    for (int node = 0; node < num_nodes_; node++) {
+      for (int c = 0; c < per_node[node] && num_cpus_ < kMaxCpus; c++) {
+        cpus_[num_cpus_++] = by_node[node][c];
+      }
+    }
+  } else if (!strcmp(FLAGS_cpu_affinity, "scatter")) {
+    num_cpus_ = 0;
+    for (int c = 0; num_cpus_ < kMaxCpus; c++) {
+      bool any = false;
+      for (int node = 0; node < num_nodes_ && num_cpus_ < kMaxCpus; node++) {
+        if (c < per_node[node]) {
+          cpus_[num_cpus_++] = by_node[node][c];
+          any = true;
+        }
+      }
+      if (!any) {
+        break;
+      }
+    }
+  } else {
+    num_cpus_ = parse_cpu_list(FLAGS_cpu_affinity, cpus_, kMaxCpus);
+    if (num_cpus_ <= 0) {
+      fprintf(stderr, "invalid cpu list '%s'\n", FLAGS_cpu_affinity);
+      exit(1);
+    }
+
+    for (int i = 0; i < num_cpus_; i++) {
+      if (cpus_[i] >= CPU_SETSIZE || !CPU_ISSET(cpus_[i], &allowed)) {
+        fprintf(stderr, "cpu %d is not available\n", cpus_[i]);
+        exit(1);
+      }
+    }
+  }
+
+  if (FLAGS_cpu_affinity != NULL && num_cpus_ == 0) {
+    fprintf(stderr, "--cpu_affinity=%s found no cpu to run on\n",
+            FLAGS_cpu_affinity);
+    exit(1);
+  }
+}
+
+/*
+ * "local" allocates on the node of the touching thread, which with pinned
+ * threads keeps each thread's generator buffers and page cache local.
+ * "interleave" spreads pages over every node.
+ */
+static void numa_apply() {
+  unsigned long mask = 0;
+  int mode;
+
+  if (FLAGS_numa_policy == NULL) {
+    return;
+  }
+  if (!strcmp(FLAGS_numa_policy, "interleave")) {
+    mode = kMpolInterleave;
+    for (int node = 0; node < num_nodes_ && node < kMaxNodes; node++) {
+      mask |= 1UL << node;
+    }
+  } else {
+    mode = kMpolLocal;
+  }
+
+  if (syscall(SYS_set_mempolicy, mode, mode == kMpolLocal ? NULL : &mask,
+              mode == kMpolLocal ? 0 : kMaxNodes + 1) != 0) {
+    fprintf(stderr, "WARNING: set_mempolicy(%s) failed\n", FLAGS_numa_policy);
+    return;
+  }
+  numa_applied_ = true;
+}
+
+/*
+ * Called once before any thread or allocation of the benchmark.  Pins the
+ * main thread to slot 0 and sets the memory policy, which threads
+ * created later inherit.
+ */
+void affinity_init() {
+  affinity_plan();
+  numa_apply();
+
+  if (num_cpus_ > 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus_[0], &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) {
+      fprintf(stderr, "pthread_setaffinity_np error\n");
+      exit(1);
+    }
+  }
+}
+
+void affinity_print_environment() {
+  if (num_cpus_ > 0) {
+    fprintf(stderr, "Affinity:   %s (", FLAGS_cpu_affinity);
+    for (int i = 0; i < num_cpus_ && i < 16; i++) {
+      fprintf(stderr, "%s%d", i > 0 ? "," : "", cpus_[i]);
+    }
+    fprintf(stderr, "%s)\n", num_cpus_ > 16 ? ",..." : "");
+  }
+  if (FLAGS_numa_policy != NULL) {
+    fprintf(stderr, "NUMA:       %d node%s, %s policy%s\n", num_nodes_,
+            num_nodes_ > 1 ? "s" : "", FLAGS_numa_policy,
+            numa_applied_ ? "" : " (not applied)");
+  }
+}
+
+/*
+ * pthread_create() that pins the new thread to the CPU of thread slot
+ * `slot`.  Slot 0 is the main thread, benchmark threads use 1 and up.
+ */
+void thread_create(pthread_t* thread, int slot, void* (*fn)(void*),
+                   void* arg) {
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+
+  if (num_cpus_ > 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus_[slot % num_cpus_], &set);
+    if (pthread_attr_setaffinity_np(&attr, sizeof(set), &set)) {
+      fprintf(stderr, "pthread_attr_setaffinity_np error\n");
+      exit(1);
+    }
+  }
+  if (pthread_create(thread, &attr, fn, arg)) {
+    fprintf(stderr, "pthread_create error\n");
+    exit(1);
+  }
+
+  pthread_attr_destroy(&attr);
+}
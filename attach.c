@@ -0,0 +1,334 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+/* Keys each join covers */
+#define kJoinRange 100
+
+/*
+ * Settings the attached databases take in turn, so that one connection
+ * mixes cipher configurations the way an application's databases do.
+ */
+static const char* const kAttachSettings[] = {
+  NULL,
+  "cipher_page_size = 8192",
+  "cipher_compatibility = 3"
+};
+
+static const char* const kJournalModes[] = { "DELETE", "WAL" };
+
+static void attach_exec(sqlite3*, const char*);
+static void attach_files(const char*, int, char (*)[1000]);
+static void attach_fill(sqlite3*, int, int, int);
+static void attach_lookups(sqlite3*, int, int, int, ThreadStats*);
+static void attach_joins(sqlite3*, int, int, int, ThreadStats*);
+static void attach_commits(sqlite3*, int, int, int, Histogram*,
+                           ThreadStats*);
+static void attach_report(const char*, const ThreadStats*);
+
+static void attach_exec(sqlite3* db, const char* sql) {
+  char* err_msg = NULL;
+  int status = sqlite3_exec(db, sql, NULL, NULL, &err_msg);
+  exec_error_check(status, err_msg);
+}
+
+/* <file_name>.attach<i> for every attached database, fresh */
+static void attach_files(const char* file_name, int num_dbs,
+                         char (*files)[1000]) {
+  for (int i = 0; i < num_dbs; i++) {
+    char extra[1100];
+    snprintf(files[i], 1000, "%s.attach%d", file_name, i);
+    remove(files[i]);
+    snprintf(extra, sizeof(extra), "%s-journal", files[i]);
+    remove(extra);
+    snprintf(extra, sizeof(extra), "%s-wal", files[i]);
+    remove(extra);
+    snprintf(extra, sizeof(extra), "%s-shm", files[i]);
+    remove(extra);
+  }
+}
+
+/* Write keys 0..num_keys-1 into every attached database, one txn each */
+static void attach_fill(sqlite3* db, int num_dbs, int num_keys,
+                        int value_size) {
+  char* value = malloc(sizeof(char) * value_size);
+  for (int i = 0; i < num_dbs; i++) {
+    char* sql = sqlite3_mprintf("CREATE TABLE a%d.test (key INTEGER PRIMARY "
+                                "KEY, value BLOB)", i);
+    attach_exec(db, sql);
+    sqlite3_free(sql);
+
+    sqlite3_stmt* stmt;
+    sql = sqlite3_mprintf("INSERT INTO a%d.test (key, value) VALUES (?, ?)", i);
+    int status = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    error_check(status);
+    sqlite3_free(sql);
+
+    attach_exec(db, "BEGIN");
+    for (int k = 0; k < num_keys; k++) {
+      status = sqlite3_bind_int(stmt, 1, k);
+      error_check(status);
+      rand_gen_fill(&gen_, value, value_size);
+      status = sqlite3_bind_blob(stmt, 2, value, value_size, SQLITE_STATIC);
+      error_check(status);
+      status = busy_step(stmt);
+      step_error_check(status);
+      sqlite3_reset(stmt);
+    }
+    attach_exec(db, "COMMIT");
+    status = sqlite3_finalize(stmt);
+    error_check(status);
+  }
+  free(value);
+}
+
+/* Look up num_ops random keys, each in a random attached database */
+static void attach_lookups(sqlite3* db, int num_dbs, int num_keys,
+                           int num_ops, ThreadStats* stats) {
+  sqlite3_stmt** stmts = calloc(sizeof(sqlite3_stmt*), num_dbs);
+  for (int i = 0; i < num_dbs; i++) {
+    char* sql = sqlite3_mprintf("SELECT value FROM a%d.test WHERE key = ?", i);
+    int status = sqlite3_prepare_v2(db, sql, -1, &stmts[i], NULL);
+    error_check(status);
+    sqlite3_free(sql);
+  }
+
+  memset(stats, 0, sizeof(ThreadStats));
+  db_pages(db, true);
+  double start = now_micros();
+  for (int n = 0; n < num_ops; n++) {
+    sqlite3_stmt* stmt = stmts[rand_next(&rand_) % num_dbs];
+    int status = sqlite3_bind_int(stmt, 1, rand_next(&rand_) % num_keys);
+    error_check(status);
+    while ((status = busy_step(stmt)) == SQLITE_ROW) {
+      stats->bytes_ += sqlite3_column_bytes(stmt, 0) + sizeof(int);
+    }
+    step_error_check(status);
+    sqlite3_reset(stmt);
+    stats->done_++;
+  }
+  stats->micros_ = now_micros() - start;
+  stats->pages_ = db_pages(db, false);
+
+  for (int i = 0; i < num_dbs; i++) {
+    int status = sqlite3_finalize(stmts[i]);
+    error_check(status);
+  }
+  free(stmts);
+}
+
+/*
+ * Join every attached database on key over kJoinRange keys at a random
+ * offset, num_ops times.
+ */
+static void attach_joins(sqlite3* db, int num_dbs, int num_keys, int num_ops,
+                         ThreadStats* stats) {
+  char* sql = sqlite3_mprintf("SELECT count(*), sum(length(t0.value))");
+  for (int i = 1; i < num_dbs; i++) {
+    char* next = sqlite3_mprintf("%s + sum(length(t%d.value))", sql, i);
+    sqlite3_free(sql);
+    sql = next;
+  }
+  char* next = sqlite3_mprintf("%s FROM a0.test t0", sql);
+  sqlite3_free(sql);
+  sql = next;
+  for (int i = 1; i < num_dbs; i++) {
+    next = sqlite3_mprintf("%s JOIN a%d.test t%d ON t%d.key = t0.key", sql, i,
+                           i, i);
+    sqlite3_free(sql);
+    sql = next;
+  }
+  next = sqlite3_mprintf("%s WHERE t0.key >= ?1 AND t0.key < ?1 + %d", sql,
+                         kJoinRange);
+  sqlite3_free(sql);
+  sql = next;
+
+  sqlite3_stmt* stmt;
+  int status = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+  error_check(status);
+  sqlite3_free(sql);
+
+  memset(stats, 0, sizeof(ThreadStats));
+  db_pages(db, true);
+  double start = now_micros();
+  for (int n = 0; n < num_ops; n++) {
+    status = sqlite3_bind_int(stmt, 1, rand_next(&rand_) % num_keys);
+    error_check(status);
+    while ((status = busy_step(stmt)) == SQLITE_ROW) {
+      stats->bytes_ += sqlite3_column_int64(stmt, 1);
+    }
+    step_error_check(status);
+    sqlite3_reset(stmt);
+    stats->done_++;
+  }
+  stats->micros_ = now_micros() - start;
+  stats->pages_ = db_pages(db, false);
+
+  status = sqlite3_finalize(stmt);
+  error_check(status);
+}
+
+/*
+ * num_ops transactions that each replace one row in every attached
+ * database and commit them together.  Under a rollback journal that
+ * commit goes through a super-journal naming every file; under WAL each
+ * file commits on its own.  commits receives the latency of each COMMIT.
+ */
+static void attach_commits(sqlite3* db, int num_dbs, int num_keys,
+                           int num_ops, Histogram* commits,
+                           ThreadStats* stats) {
+  sqlite3_stmt** stmts = calloc(sizeof(sqlite3_stmt*), num_dbs);
+  for (int i = 0; i < num_dbs; i++) {
+    char* sql = sqlite3_mprintf("REPLACE INTO a%d.test (key, value) "
+                                "VALUES (?, ?)", i);
+    int status = sqlite3_prepare_v2(db, sql, -1, &stmts[i], NULL);
+    error_check(status);
+    sqlite3_free(sql);
+  }
+
+  char* value = malloc(sizeof(char) * FLAGS_value_size);
+  histogram_clear(commits);
+  memset(stats, 0, sizeof(ThreadStats));
+  db_pages(db, true);
+  double start = now_micros();
+  for (int n = 0; n < num_ops; n++) {
+    attach_exec(db, "BEGIN");
+    for (int i = 0; i < num_dbs; i++) {
+      int status = sqlite3_bind_int(stmts[i], 1, rand_next(&rand_) % num_keys);
+      error_check(status);
+      rand_gen_fill(&gen_, value, FLAGS_value_size);
+      status = sqlite3_bind_blob(stmts[i], 2, value, FLAGS_value_size,
+                                 SQLITE_STATIC);
+      error_check(status);
+      status = busy_step(stmts[i]);
+      step_error_check(status);
+      sqlite3_reset(stmts[i]);
+      stats->bytes_ += FLAGS_value_size + sizeof(int);
+    }
+    double commit_start = now_micros();
+    attach_exec(db, "COMMIT");
+    histogram_add(commits, now_micros() - commit_start);
+    stats->done_++;
+  }
+  stats->micros_ = now_micros() - start;
+  stats->pages_ = db_pages(db, false);
+
+  for (int i = 0; i < num_dbs; i++) {
+    int status = sqlite3_finalize(stmts[i]);
+    error_check(status);
+  }
+  free(stmts);
+  free(value);
+}
+
+static void attach_report(const char* what, const ThreadStats* stats) {
+  fprintf(stderr, "%-12s : %s %.3f micros/op, %.0f ops/sec",
+          "attach", what,
+          stats->done_ > 0 ? stats->micros_ / stats->done_ : 0.0,
+          stats->micros_ > 0 ? stats->done_ / (stats->micros_ / 1e6) : 0.0);
+  if (stats->bytes_ > 0 && stats->micros_ > 0) {
+    fprintf(stderr, ", %.1f MB/s",
+            (stats->bytes_ / 1048576.0) / (stats->micros_ / 1e6));
+  }
+  fprintf(stderr, ";\n");
+}
+
+/*
+ * Attach num_dbs databases to a connection to file_name, each with its own
+ * key and with the settings of kAttachSettings in turn, and fill each with
+ * num_keys rows.  Then run num_reads lookups in random databases,
+ * num_reads / kJoinRange joins across all of them (at least one), and
+ * num_keys / 1000 transactions that write to all of them, under a
+ * rollback journal and under WAL with FULL sync.  Exits if SQLite cannot
+ * attach num_dbs databases.
+ */
+void attach_run(const char* file_name, int num_dbs, int num_keys,
+                int num_reads, ThreadStats* total) {
+  char (*files)[1000] = calloc(sizeof(*files), num_dbs);
+  attach_files(file_name, num_dbs, files);
+
+  memset(total, 0, sizeof(ThreadStats));
+  sqlite3* db = benchmark_open_db(file_name, 0, false);
+  int max_attached = sqlite3_limit(db, SQLITE_LIMIT_ATTACHED, -1);
+  if (num_dbs > max_attached) {
+    fprintf(stderr, "--attach=%d is more than the %d databases SQLite "
+            "attaches to a connection\n", num_dbs, max_attached);
+    exit(1);
+  }
+  for (int i = 0; i < num_dbs; i++) {
+    char* sql;
+    char* name = storage_attach_name(files[i]);
+    if (FLAGS_use_sqlcipher) {
+      sql = sqlite3_mprintf("ATTACH DATABASE %Q AS a%d KEY '%q-%d'", name,
+                            i, FLAGS_key, i);
+    } else {
+      sql = sqlite3_mprintf("ATTACH DATABASE %Q AS a%d", name, i);
+    }
+    attach_exec(db, sql);
+    sqlite3_free(sql);
+    sqlite3_free(name);
+
+    const char* setting = kAttachSettings[i % (sizeof(kAttachSettings) /
+                                               sizeof(kAttachSettings[0]))];
+    if (FLAGS_use_sqlcipher && setting != NULL) {
+      sql = sqlite3_mprintf("PRAGMA a%d.%s", i, setting);
+      attach_exec(db, sql);
+      sqlite3_free(sql);
+    }
+  }
+  attach_fill(db, num_dbs, num_keys, FLAGS_value_size);
+  fprintf(stderr, "%-12s : %d databases of %d rows, %s;\n", "attach",
+          num_dbs, num_keys,
+          FLAGS_use_sqlcipher ? "each with its own key" : "plaintext");
+
+  ThreadStats stats;
+  attach_lookups(db, num_dbs, num_keys, num_reads, &stats);
+  attach_report("lookup", &stats);
+  total->done_ += stats.done_;
+  total->bytes_ += stats.bytes_;
+  total->micros_ += stats.micros_;
+  total->pages_ += stats.pages_;
+
+  int num_joins = num_reads / kJoinRange > 0 ? num_reads / kJoinRange : 1;
+  attach_joins(db, num_dbs, num_keys, num_joins, &stats);
+  attach_report("join", &stats);
+  total->done_ += stats.done_;
+  total->bytes_ += stats.bytes_;
+  total->micros_ += stats.micros_;
+  total->pages_ += stats.pages_;
+
+  int num_txns = num_keys / 1000 > 0 ? num_keys / 1000 : 1;
+  for (size_t m = 0; m < sizeof(kJournalModes) / sizeof(kJournalModes[0]);
+       m++) {
+    for (int i = 0; i < num_dbs; i++) {
+      char* sql = sqlite3_mprintf("PRAGMA a%d.journal_mode = %s", i,
+                                  kJournalModes[m]);
+      attach_exec(db, sql);
+      sqlite3_free(sql);
+      sql = sqlite3_mprintf("PRAGMA a%d.synchronous = FULL", i);
+      attach_exec(db, sql);
+      sqlite3_free(sql);
+    }
+
+    char what[100];
+    snprintf(what, sizeof(what), "%d-database txn (%s)", num_dbs,
+             kJournalModes[m]);
+    Histogram commits;
+    attach_commits(db, num_dbs, num_keys, num_txns, &commits, &stats);
+    attach_report(what, &stats);
+    fprintf(stderr, "%-12s : %s commit %.3f micros avg, %.3f median, "
+            "%.3f p99;\n", "attach", kJournalModes[m],
+            histogram_average(&commits), histogram_median(&commits),
+            histogram_percentile(&commits, 99.0));
+    total->done_ += stats.done_;
+    total->bytes_ += stats.bytes_;
+    total->micros_ += stats.micros_;
+    total->pages_ += stats.pages_;
+  }
+
+  int status = sqlite3_close(db);
+  error_check(status);
+  free(files);
+}
@@ -8,7 +8,10 @@
 #include <assert.h>
 #include <ctype.h>
 #include <dirent.h>
+#include <inttypes.h>
 #include <math.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -22,6 +25,18 @@
 #define kNumData 1000000
 #define MAXNUMPERTIME 500000
 
+enum Order {
+  SEQUENTIAL,
+  RANDOM
+};
+
+/* What export_run() migrates */
+enum ExportMode {
+  kExportEncrypt,
+  kExportDecrypt,
+  kExportReencrypt
+};
+
 typedef struct Random {
   uint32_t seed_;
 } Random;
@@ -32,6 +47,79 @@ typedef struct RandomGenerator {
   int pos_;
 } RandomGenerator;
 
+/* A batch of prepared key/value pairs handed from a generator to the writer */
+typedef struct Batch {
+  int num_;
+  int* keys_;
+  char* values_;
+} Batch;
+
+typedef struct RingSlot {
+  uint64_t seq_;
+  Batch* batch_;
+} RingSlot;
+
+/* Bounded lock-free multi-producer single-consumer queue of batches */
+typedef struct Ring {
+  RingSlot* slots_;
+  uint64_t mask_;
+  uint64_t enqueue_pos_ __attribute__((aligned(64)));
+  uint64_t dequeue_pos_ __attribute__((aligned(64)));
+} Ring;
+
+/*
+ * Counters kept by each benchmark thread.  pages_ is db_pages() of its
+ * connections over the run.
+ */
+typedef struct ThreadStats {
+  int done_;
+  int64_t bytes_;
+  double micros_;
+  int64_t pages_;
+} ThreadStats;
+
+/* Latency histogram after LevelDB's, values in microseconds */
+typedef struct Histogram {
+  double min_;
+  double max_;
+  double num_;
+  double sum_;
+  double sum_squares_;
+  double buckets_[kNumBuckets];
+} Histogram;
+
+/* Threads running random lookups, see reader.c */
+typedef struct Readers {
+  struct Reader* readers_;
+  int num_threads_;
+  double start_;
+} Readers;
+
+typedef struct Pipeline {
+  Ring ring_;
+  struct Generator* generators_;
+  int num_threads_;
+  int order_;
+  int num_entries_;
+  int value_size_;
+  int batch_size_;
+  int num_batches_;
+  int next_batch_;
+  int next_push_;
+  int consumed_;
+  int64_t producer_stalls_;
+  int64_t turn_waits_;
+  int64_t writer_stalls_;
+  double writer_wait_micros_;
+} Pipeline;
+
+/* O_DIRECT descriptor of a file and its aligned buffer, see vfsdirect.c */
+typedef struct VfsDirect {
+  int fd_;
+  unsigned char* buf_;
+  size_t size_;
+} VfsDirect;
+
 // Comma-separated list of operations to run in the specified order
 //   Actual benchmarks:
 //
@@ -47,6 +135,32 @@ typedef struct RandomGenerator {
 //   readseq       -- read N times sequentially
 //   readrandom    -- read N times in random order
 //   readrand100K  -- read N/1000 100K values in sequential order in async mode
+//   fillcontend   -- write N values in random key order from FLAGS_threads
+//                    connections to the same database
+//   poolprivate   -- read N times in random order from FLAGS_threads workers
+//                    sharing FLAGS_pool_size private-cache connections
+//   poolshared    -- same as poolprivate with a shared cache and
+//                    read_uncommitted
+//   threadmodes   -- read N times in random order in every threading mode,
+//                    from one thread and from FLAGS_threads threads
+//   openkey       -- open, key, query and close a connection FLAGS_opens
+//                    times
+//   rekey         -- rotate the key of the database with PRAGMA rekey and
+//                    back, one op per page
+//   export_encrypt   -- sqlcipher_export() the plaintext database into an
+//                       encrypted copy, one op per page
+//   export_decrypt   -- sqlcipher_export() the encrypted database into a
+//                       plaintext copy
+//   export_reencrypt -- sqlcipher_export() the encrypted database into a copy
+//                       with FLAGS_export_compatibility settings
+//   cryptobench   -- encrypt and decrypt pages of 1K to 64K with AES-256-CBC
+//                    and HMAC-SHA512 alone, from 1 and FLAGS_threads threads
+//   integrity     -- PRAGMA integrity_check and cipher_integrity_check, one
+//                    op per page
+//   integrityread -- read N times in random order, alone and while the
+//                    integrity checks run on another connection
+//   attach        -- attach FLAGS_attach databases with their own keys and
+//                    settings, then look up, join and commit across them
 extern char* FLAGS_benchmarks;
 
 // Number of key/values to place in database
@@ -69,6 +183,11 @@ extern int FLAGS_page_size;
 // Default cache size = FLAGS_page_size * FLAGS_num_pages = 4 MB.
 extern int FLAGS_num_pages;
 
+// Bytes of the database file each connection memory-maps with PRAGMA
+// mmap_size, -1 leaves the SQLite default.  Page faults and RSS are
+// reported after each benchmark when set.
+extern int64_t FLAGS_mmap_size;
+
 // If true, do not destroy the existing database.  If you set this
 // flag and also specify a benchmark that wants a fresh database, that
 // benchmark will fail.
@@ -89,24 +208,325 @@ extern bool FLAGS_use_sqlcipher;
 // Use the key to access to sqlcipher
 extern char* FLAGS_key;
 
+// How FLAGS_key is handed to sqlcipher: "passphrase" runs it through the
+// KDF, "raw" uses it as a 32-byte key given as 64 hex digits, and
+// "raw_with_salt" adds FLAGS_key_salt to the raw key.
+extern char* FLAGS_key_mode;
+
+// Database salt as 32 hex digits, used with --key_mode=raw_with_salt
+extern char* FLAGS_key_salt;
+
+// Number of generator threads feeding the writer.  If 0, keys and values
+// are generated up front by the writer itself.
+extern int FLAGS_pipeline_threads;
+
+// Number of batches the generator/writer queue can hold
+extern int FLAGS_pipeline_depth;
+
+// Number of database files dbbench_sqlite3.<i>.db the keys are spread
+// over, each written and read by its own thread.  1 disables sharding.
+extern int FLAGS_shards;
+
+// How keys are routed to shards: "hash" or "range"
+extern char* FLAGS_shard_routing;
+
+// Number of threads, each with its own connection, used by the
+// multi-threaded benchmarks
+extern int FLAGS_threads;
+
+// What a connection does when it finds the database locked: "none" fails
+// at once, "timeout" waits like sqlite3_busy_timeout(), "backoff" waits
+// with exponential backoff and "retry" retries immediately.
+extern char* FLAGS_busy_strategy;
+
+// Milliseconds a connection waits for a lock before giving up
+extern int FLAGS_busy_timeout;
+
+// Number of connections in the pool used by the pool benchmarks
+extern int FLAGS_pool_size;
+
+// Number of connections the openkey benchmark opens
+extern int FLAGS_opens;
+
+// SQLCipher major version whose default settings export_reencrypt
+// writes the copy with
+extern int FLAGS_export_compatibility;
+
+// Number of encrypted databases the attach benchmark attaches
+extern int FLAGS_attach;
+
+// SQLite threading mode set with sqlite3_config() before
+// sqlite3_initialize(): "single", "multi" or "serialized".  NULL keeps the
+// mode the library was compiled with.
+extern char* FLAGS_threading_mode;
+
+// CPUs benchmark threads are pinned to: "compact" fills one NUMA node
+// before the next, "scatter" deals threads round-robin over the nodes,
+// or an explicit list such as "0,2,4-7".  NULL leaves threads unpinned.
+extern char* FLAGS_cpu_affinity;
+
+// NUMA memory policy: "local" or "interleave".  NULL leaves the policy the
+// process was started with.
+extern char* FLAGS_numa_policy;
+
+// SQLCipher page size in bytes.  0 keeps the library default.
+extern int FLAGS_cipher_page_size;
+
+// PBKDF2 iterations used to derive the key.  0 keeps the library default.
+extern int FLAGS_kdf_iter;
+
+// HMAC algorithm: "HMAC_SHA1", "HMAC_SHA256" or "HMAC_SHA512".  NULL keeps
+// the library default.  "off" sets FLAGS_cipher_use_hmac to 0 instead.
+extern char* FLAGS_cipher_hmac_algorithm;
+
+// KDF algorithm: "PBKDF2_HMAC_SHA1", "PBKDF2_HMAC_SHA256" or
+// "PBKDF2_HMAC_SHA512".  NULL keeps the library default.
+extern char* FLAGS_cipher_kdf_algorithm;
+
+// If 0, pages carry no HMAC.  -1 keeps the library default.
+extern int FLAGS_cipher_use_hmac;
+
+// Use the default settings of SQLCipher major version 1 to 4.  0 keeps the
+// library default.  Applied before the other cipher flags.
+extern int FLAGS_cipher_compatibility;
+
+// Bytes at the start of page 1 left unencrypted, so that the header is
+// readable without the key.  -1 keeps the library default (0).
+extern int FLAGS_cipher_plaintext_header_size;
+
+// Salt of 32 hex digits used when the header is plaintext and so cannot
+// hold it.  NULL uses a fixed salt.
+extern char* FLAGS_cipher_salt;
+
+// If 1, SQLCipher wipes and mlock()s the memory it allocates, if 0 it
+// does not.  -1 keeps the library default.  Process-wide, set once
+// before any connection is opened.
+extern int FLAGS_cipher_memory_security;
+
+// If true, count and time the reads, writes, syncs, truncates, locks and
+// shm operations of every connection through a pass-through VFS, per
+// file kind, and report them after each benchmark.
+extern bool FLAGS_vfs_stats;
+
+// Delay in microseconds added to every read, write or sync: "200",
+// "100-300" for uniform jitter, or "exp200" for an exponential with that
+// mean.  NULL adds none.
+extern char* FLAGS_vfs_read_latency;
+extern char* FLAGS_vfs_write_latency;
+extern char* FLAGS_vfs_sync_latency;
+
+// Bandwidth in MB/s that reads and writes share, as on one device.  0 is
+// unlimited.
+extern double FLAGS_vfs_bandwidth;
+
+// If 1, read and write the main database and the WAL with O_DIRECT, so
+// only SQLite caches their pages.  0 or 1 also reports the memory the
+// database takes in the process and the kernel page cache; -1 neither.
+extern int FLAGS_vfs_direct;
+
+// If true, write and sync the main database and the WAL through io_uring:
+// the writes of a transaction are queued and submitted with a linked
+// fsync in one system call when SQLite syncs.
+extern bool FLAGS_vfs_uring;
+
+// Where the database files live: "file" in --db, "tmpfs" in /dev/shm,
+// or "memdb" in process memory through the memdb VFS, still encrypted
+// page by page but with no file I/O at all.
+extern char* FLAGS_storage;
+
+// Run every benchmark once per combination of flag values, given as
+// "flag=v1:v2:...,flag=v1:v2:...", and compare the combinations at the
+// end.  NULL runs the benchmarks once.
+extern char* FLAGS_sweep;
+
+// Run every benchmark on a plaintext and on an encrypted database in
+// turn, with the same keys and values, and report the encrypted run
+// relative to the plaintext one.  Needs FLAGS_key.
+extern bool FLAGS_compare_plaintext;
+
+// Run every benchmark with the per-page HMAC off and with each HMAC
+// algorithm in turn, and report the cost per page read or written.
+extern bool FLAGS_compare_hmac;
+
+// Run every benchmark without and with memory-mapped I/O, mmap_size 0
+// and FLAGS_mmap_size (1 GB if unset), and report page faults per op.
+extern bool FLAGS_compare_mmap;
+
+// Run only this combination of FLAGS_sweep and report the results on
+// stdout.  Used by sweeps over per-process flags, -1 otherwise.
+extern int FLAGS_sweep_combo;
+
+// Directories holding the SQLCipher builds to compare, "dir1:dir2".  Runs
+// the benchmarks once per build, each in a process started with its
+// directory in front of LD_LIBRARY_PATH.  NULL uses the linked build.
+extern char* FLAGS_sqlcipher_libs;
+
+// Directory of the SQLCipher build this process was started with, set by
+// the sweep over FLAGS_sqlcipher_libs.
+extern char* FLAGS_sqlcipher_lib;
+
+// Seed of the generated keys and values.  0 seeds from the clock.
+extern int FLAGS_seed;
+
+/* main.c */
+bool parse_flag(char*);
+
+/* affinity.c */
+void affinity_init(void);
+void affinity_print_environment(void);
+void thread_create(pthread_t*, int, void* (*)(void*), void*);
+
 /* benchmark.c */
+extern RandomGenerator gen_;
+extern Random rand_;
 void benchmark_init(void);
 void benchmark_fini(void);
 void benchmark_run(void);
 void benchmark_open(void);
+sqlite3* benchmark_open_db(const char*, int, bool);
+char* benchmark_key_string(void);
+void benchmark_key(sqlite3*);
 void benchmark_write(bool, int, int, int, int);
 void benchmark_read(int, int);
 void benchmark_delete(bool, int, int);
 void benchmark_read_sequential(void);
 
+/* histogram.c */
+void histogram_clear(Histogram*);
+void histogram_add(Histogram*, double);
+double histogram_median(const Histogram*);
+double histogram_percentile(const Histogram*, double);
+double histogram_average(const Histogram*);
+double histogram_stddev(const Histogram*);
+void histogram_print(const Histogram*);
+
+/* openkey.c */
+void openkey_run(const char*, int, ThreadStats*);
+
+/* cryptobench.c */
+void cryptobench_run(ThreadStats*);
+
+/* integrity.c */
+void integrity_run(const char*, ThreadStats*);
+void integrity_read(const char*, int, int, ThreadStats*);
+
+/* attach.c */
+void attach_run(const char*, int, int, int, ThreadStats*);
+
+/* vfsshim.c */
+bool vfsshim_parse_latency(const char*);
+bool vfsshim_enabled(void);
+void vfsshim_init(void);
+void vfsshim_restore(void);
+void vfsshim_reset(void);
+void vfsshim_report(const char*);
+
+/* storage.c */
+void storage_init(void);
+bool storage_memdb(void);
+bool storage_journal_in_memory(void);
+int storage_open(const char*, sqlite3**, int);
+char* storage_attach_name(const char*);
+void storage_fini(void);
+
+/* vfsdirect.c */
+int vfsdirect_shared_fd(const char*, int);
+void vfsdirect_open(VfsDirect*, const char*);
+void vfsdirect_close(VfsDirect*);
+int vfsdirect_read(VfsDirect*, void*, int, int64_t);
+int vfsdirect_write(VfsDirect*, const void*, int, int64_t);
+void vfsdirect_report(const char*, const char*);
+
+/* vfsuring.c */
+void vfsuring_init(void);
+bool vfsuring_full(void);
+int vfsuring_write(int, const void*, int, int64_t);
+int vfsuring_sync(int);
+int vfsuring_flush(int);
+void vfsuring_reset(void);
+void vfsuring_report(const char*);
+
+/* export.c */
+void export_run(const char*, int, ThreadStats*);
+
+/* rekey.c */
+void rekey_run(const char*, ThreadStats*);
+
+/* pipeline.c */
+void pipeline_start(Pipeline*, const RandomGenerator*, uint32_t, int, int,
+                    int, int, int, int);
+Batch* pipeline_next(Pipeline*);
+void pipeline_stop(Pipeline*, double);
+void batch_free(Batch*);
+
+/* busy.c */
+void busy_install(sqlite3*);
+int busy_step(sqlite3_stmt*);
+void busy_exec(sqlite3*, const char*);
+void busy_failed_txn(void);
+void busy_reset(void);
+void busy_report(const char*);
+
+/* contend.c */
+void contend_write(const char*, bool, int, int, ThreadStats*);
+
+/* pool.c */
+void pool_read(const char*, bool, int, int, ThreadStats*);
+
+/* reader.c */
+void readers_start(Readers*, const char*, int, int, int);
+void readers_join(Readers*, ThreadStats*);
+
+/* shard.c */
+void shard_open(void);
+void shard_close(void);
+void shard_exec(const char*);
+void shard_write(bool, int, int, int, ThreadStats*);
+void shard_read(int, int, int, ThreadStats*);
+
+/* sweep.c */
+void sweep_init(int, char**);
+int sweep_count(void);
+bool sweep_interleaved(void);
+bool sweep_in_processes(void);
+void sweep_run_processes(void);
+const char* sweep_spec(void);
+bool sweep_has_value(const char*, const char*);
+void sweep_file_suffix(char*, size_t);
+void sweep_apply(int);
+void sweep_print_header(void);
+void sweep_record(const char*, int, double, int64_t, int64_t, int64_t);
+void sweep_report(void);
+
+/* threading.c */
+void threading_init(void);
+const char* threading_mode(void);
+int threading_open_flags(void);
+void threading_sweep(const char*, int, int, ThreadStats*);
+
 /* random.c */
 void rand_init(Random*, uint32_t);
 uint32_t rand_next(Random*);
 uint32_t rand_uniform(Random*, int);
-void rand_gen_init(RandomGenerator*, double);
+void rand_gen_init(RandomGenerator*, double, uint32_t);
 char* rand_gen_generate(RandomGenerator*, int);
+void rand_gen_fill(RandomGenerator*, char*, int);
 
 /* util.c */
+void exec_error_check(int, char*);
+void step_error_check(int);
+void error_check(int);
+void wal_checkpoint(sqlite3*);
+int64_t db_pages(sqlite3*, bool);
+int64_t query_int(sqlite3*, const char*);
+char* query_text(sqlite3*, const char*);
+int64_t file_size(const char*);
+bool is_dir(const char*);
+bool max_rss_reset(void);
+int64_t max_rss(void);
+int64_t current_rss(void);
+void page_faults(int64_t*, int64_t*);
+bool is_hex(const char*, size_t);
 uint64_t now_micros(void);
 bool starts_with(const char*, const char*);
 char* trim_space(const char*);
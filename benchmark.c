@@ -4,11 +4,6 @@
 
 #include "bench.h"
 
-enum Order {
-  SEQUENTIAL,
-  RANDOM
-};
-
 sqlite3* db_;
 int num_;
 int reads_;
@@ -18,6 +13,28 @@ char* message_;
 RandomGenerator gen_;
 Random rand_;
 
+/* Path of the main database, kept to reopen db_ */
+static char db_file_name_[100];
+
+/* Seed of rand_ and gen_, every sweep combination replays the same keys */
+static uint32_t seed_;
+
+/* Latency of the last benchmark_open() */
+static double open_micros_;
+
+/* PRAGMA cipher_memory_security as read back after applying the flag */
+static int memory_security_;
+
+/* Pages read from disk and written since start(), by db_ or the threads */
+static int64_t pages_;
+
+/* The benchmark ran on connections of its own, see add_thread_stats() */
+static bool threaded_;
+
+/* Page faults of the process when start() was called */
+static int64_t minor_faults_;
+static int64_t major_faults_;
+
 /* State kept for progress messages */
 int done_;
 int next_report_;
@@ -27,40 +44,24 @@ static void print_warnings(void);
 static void print_environment(void);
 static void start(void);
 static void stop(const char *name);
-
-inline
-static void exec_error_check(int status, char *err_msg) {
-  if (status != SQLITE_OK) {
-    fprintf(stderr, "SQL error: %s\n", err_msg);
-    sqlite3_free(err_msg);
-    exit(1);
-  }
-}
-
-inline
-static void step_error_check(int status) {
-  if (status != SQLITE_DONE) {
-    fprintf(stderr, "SQL step error: status = %d\n", status);
-    exit(1);
-  }
-}
-
-inline
-static void error_check(int status) {
-  if (status != SQLITE_OK) {
-    fprintf(stderr, "sqlite3 error: status = %d\n", status);
-    exit(1);
-  }
-}
-
-inline
-static void wal_checkpoint(sqlite3* db_) {
-  /* Flush all writes to disk */
-  if (FLAGS_WAL_enabled) {
-    sqlite3_wal_checkpoint_v2(db_, NULL, SQLITE_CHECKPOINT_FULL, NULL,
-                              NULL);
-  }
-}
+static void run_benchmark(char*);
+static void apply_cipher_settings(sqlite3*);
+static const char* cipher_salt(void);
+static void apply_memory_security(void);
+static void print_cipher_environment(void);
+static void benchmark_write_pipelined(bool, int, int, int, int);
+static void add_thread_stats(const ThreadStats*);
+static void close_main_db(void);
+static void reopen_main_db(void);
+static void benchmark_contend(bool, int, int);
+static void benchmark_pool(bool);
+static void benchmark_threading_modes(void);
+static void benchmark_openkey(void);
+static void benchmark_rekey(void);
+static void benchmark_export(int);
+static void benchmark_cryptobench(void);
+static void benchmark_integrity(bool);
+static void benchmark_attach(void);
 
 static void print_header() {
   const int kKeySize = 16;
@@ -71,6 +72,51 @@ static void print_header() {
   fprintf(stderr, "RawSize:    %.1f MB (estimated)\n",
             (((int64_t)(kKeySize + FLAGS_value_size) * num_)
             / 1048576.0));
+  fprintf(stderr, "Threading:  %s\n", threading_mode());
+  if (FLAGS_mmap_size >= 0) {
+    fprintf(stderr, "Mmap:       %" PRId64 " bytes\n", FLAGS_mmap_size);
+  }
+  if (FLAGS_shards > 1) {
+    fprintf(stderr, "Shards:     %d (%s routing)\n", FLAGS_shards,
+            FLAGS_shard_routing);
+  }
+  if (FLAGS_use_sqlcipher) {
+    fprintf(stderr, "Key:        %s\n", FLAGS_key_mode);
+    fprintf(stderr, "MemSecure:  %s\n", memory_security_ ? "on" : "off");
+    if (FLAGS_cipher_plaintext_header_size > 0) {
+      fprintf(stderr, "Header:     %d bytes plaintext, salt %s\n",
+              FLAGS_cipher_plaintext_header_size, cipher_salt());
+    }
+  }
+  if (strcmp(FLAGS_storage, "file") || storage_journal_in_memory()) {
+    fprintf(stderr, "Storage:    %s in %s%s\n", FLAGS_storage,
+            storage_memdb() ? "process memory" : FLAGS_db,
+            storage_journal_in_memory() ? ", journal in memory, no WAL" : "");
+  }
+  if (FLAGS_vfs_read_latency != NULL || FLAGS_vfs_write_latency != NULL ||
+      FLAGS_vfs_sync_latency != NULL || FLAGS_vfs_bandwidth > 0) {
+    fprintf(stderr, "Storage:    read %s, write %s, sync %s micros, ",
+            FLAGS_vfs_read_latency ? FLAGS_vfs_read_latency : "0",
+            FLAGS_vfs_write_latency ? FLAGS_vfs_write_latency : "0",
+            FLAGS_vfs_sync_latency ? FLAGS_vfs_sync_latency : "0");
+    if (FLAGS_vfs_bandwidth > 0) {
+      fprintf(stderr, "%.1f MB/s\n", FLAGS_vfs_bandwidth);
+    } else {
+      fprintf(stderr, "no bandwidth cap\n");
+    }
+  }
+  if (FLAGS_vfs_direct == 1) {
+    fprintf(stderr, "Storage:    O_DIRECT on the database and WAL\n");
+  }
+  if (FLAGS_vfs_uring) {
+    fprintf(stderr, "Storage:    io_uring writes and fsyncs on the database "
+            "and WAL\n");
+  }
+  fprintf(stderr, "Seed:       %" PRIu32 "\n", seed_);
+  if (sweep_spec() != NULL) {
+    fprintf(stderr, "Sweep:      %s (%d combinations)\n", sweep_spec(),
+            sweep_count());
+  }
   print_warnings();
   fprintf(stderr, "------------------------------------------------\n");
 }
@@ -89,7 +135,8 @@ static void print_warnings() {
 }
 
 static void print_environment() {
-  fprintf(stderr, "SQLite:     version %s\n", SQLITE_VERSION);
+  fprintf(stderr, "SQLite:     version %s\n", sqlite3_libversion());
+  print_cipher_environment();
 #if defined(__linux)
   time_t now = time(NULL);
   fprintf(stderr, "Date:       %s", ctime(&now));
@@ -129,6 +176,7 @@ static void print_environment() {
     free(cache_size);
   }
 #endif
+  affinity_print_environment();
 }
 
 static void start() {
@@ -138,6 +186,14 @@ static void start() {
   done_ = 0;
   next_report_ = 100;
   op_total_time_ = 0;
+  busy_reset();
+  vfsshim_reset();
+  page_faults(&minor_faults_, &major_faults_);
+  pages_ = 0;
+  threaded_ = false;
+  if (db_ != NULL) {
+    db_pages(db_, true);
+  }
 }
 
 static void stop(const char* name) {
@@ -156,10 +212,44 @@ static void stop(const char* name) {
 
   fprintf(stderr, "%-12s : %.3f micros/op;\n", name, op_total_time_ / done_);
   fprintf(stderr, "%-12s : %.3f micros in total;\n", name, op_total_time_);
+  busy_report(name);
+  vfsshim_report(name);
+  vfsdirect_report(name, db_file_name_);
+
+  /* Mapped pages are faulted in rather than read, and count in the RSS */
+  int64_t minor, major;
+  page_faults(&minor, &major);
+  minor -= minor_faults_;
+  major -= major_faults_;
+  if (FLAGS_mmap_size >= 0) {
+    fprintf(stderr, "%-12s : %" PRId64 " minor, %" PRId64 " major page "
+            "faults, %.3f per op, %.1f MB RSS;\n", name, minor, major,
+            (double)(minor + major) / done_, current_rss() / 1048576.0);
+  }
+
+  /*
+   * Each page read is decrypted and each page written encrypted.  A run on
+   * other connections brings their pages along, and db_ sat it out.
+   */
+  if (!threaded_ && db_ != NULL) {
+    pages_ += db_pages(db_, false);
+  }
+  sweep_record(name, done_, op_total_time_, bytes_, pages_, minor + major);
   fflush(stdout);
   fflush(stderr);
 }
 
+/*
+ * Fold the counters of a multi-threaded run into the current benchmark.
+ */
+static void add_thread_stats(const ThreadStats* stats) {
+  done_ += stats->done_;
+  bytes_ += stats->bytes_;
+  op_total_time_ += stats->micros_;
+  pages_ += stats->pages_;
+  threaded_ = true;
+}
+
 void finish_single_op() {
   done_++;
   if (done_ >= next_report_) {
@@ -198,8 +288,13 @@ void benchmark_init() {
   num_ = FLAGS_num;
   reads_ = FLAGS_reads < 0 ? FLAGS_num : FLAGS_reads;
   bytes_ = 0;
-  rand_gen_init(&gen_, FLAGS_compression_ratio);
-  rand_init(&rand_, time(0));
+  seed_ = FLAGS_seed != 0 ? (uint32_t)FLAGS_seed : (uint32_t)time(0);
+  if (vfsshim_enabled()) {
+    vfsshim_init();
+  }
+  apply_memory_security();
+  rand_gen_init(&gen_, FLAGS_compression_ratio, seed_);
+  rand_init(&rand_, seed_);
 
   struct dirent* ep;
   DIR* test_dir = opendir(FLAGS_db);
@@ -217,16 +312,97 @@ void benchmark_init() {
 }
 
 void benchmark_fini() {
+  if (FLAGS_shards > 1) {
+    shard_close();
+  }
   int status = sqlite3_close(db_);
   error_check(status);
+  db_ = NULL;
 }
 
+/*
+ * Version, crypto provider and FIPS status of the SQLCipher build that
+ * was loaded, which the provider only reports on a keyed connection.
+ */
+static void print_cipher_environment() {
+  sqlite3* db;
+  int status = sqlite3_open(":memory:", &db);
+  error_check(status);
+
+  char* version = query_text(db, "PRAGMA cipher_version");
+  if (version[0] == '\0') {
+    fprintf(stderr, "SQLCipher:  not found\n");
+  } else {
+    status = sqlite3_key(db, "bench", 5);
+    error_check(status);
+    char* provider = query_text(db, "PRAGMA cipher_provider");
+    char* provider_version = query_text(db, "PRAGMA cipher_provider_version");
+    fprintf(stderr, "SQLCipher:  version %s\n", version);
+    fprintf(stderr, "Provider:   %s %s, FIPS %s\n", provider, provider_version,
+            query_int(db, "PRAGMA cipher_fips_status") ? "on" : "off");
+    sqlite3_free(provider);
+    sqlite3_free(provider_version);
+  }
+  sqlite3_free(version);
+
+  status = sqlite3_close(db);
+  error_check(status);
+}
+
+/*
+ * cipher_memory_security is process-wide, so it is set once on a
+ * connection of its own before any benchmark connection is opened, and
+ * swept by running each value in its own process.
+ */
+static void apply_memory_security() {
+  sqlite3* db;
+  int status = sqlite3_open(":memory:", &db);
+  error_check(status);
+
+  if (FLAGS_cipher_memory_security >= 0) {
+    char* err_msg = NULL;
+    status = sqlite3_exec(db, FLAGS_cipher_memory_security ?
+                              "PRAGMA cipher_memory_security = ON" :
+                              "PRAGMA cipher_memory_security = OFF",
+                          NULL, NULL, &err_msg);
+    exec_error_check(status, err_msg);
+  }
+  memory_security_ = (int)query_int(db, "PRAGMA cipher_memory_security");
+
+  status = sqlite3_close(db);
+  error_check(status);
+}
+
+/*
+ * Run the benchmark list.  When sweeping, each benchmark runs under every
+ * combination in turn, on that combination's own database files, with
+ * the same keys and values, before the next benchmark starts.  Sweeps
+ * over per-process flags run each combination in a process instead.
+ */
 void benchmark_run() {
-  print_header();
-  benchmark_open();
+  /* A sweep child only adds its own section to the parent's output */
+  if (FLAGS_sweep_combo < 0) {
+    print_header();
+  }
+
+  if (sweep_in_processes()) {
+    sweep_run_processes();
+    sweep_report();
+    return;
+  }
+
+  bool sweeping = sweep_interleaved();
+  if (!sweeping) {
+    sweep_print_header();
+    if (FLAGS_sqlcipher_lib != NULL) {
+      print_cipher_environment();
+    }
+    benchmark_open();
+    sweep_record("open", 1, open_micros_, 0, 0, 0);
+  }
 
   char* benchmarks = FLAGS_benchmarks;
-  while (benchmarks != NULL) {
+  for (int slot = 0; benchmarks != NULL; slot++) {
     char* sep = strchr(benchmarks, ',');
     char* name;
     if (sep == NULL) {
@@ -237,147 +413,464 @@ void benchmark_run() {
       strncpy(name, benchmarks, sep - benchmarks);
       benchmarks = sep + 1;
     }
-    if (if_create_database(name)) {
-      int status;
-      char* err_msg = NULL;
-      /* create tables/index for database if bench is not overwrite*/
-      char* create_stmt =
-              "CREATE TABLE test (key int, value text, PRIMARY KEY (key))";
-      status = sqlite3_exec(db_, create_stmt, NULL, NULL, &err_msg);
-      exec_error_check(status, err_msg);
+    if (!strcmp(name, "")) {
+      continue;
     }
-    bytes_ = 0;
-    start();
-    bool known = true;
-    bool write_sync = false;
-    if (!strcmp(name, "fillseq")) {
-      benchmark_write(write_sync, SEQUENTIAL, num_, FLAGS_value_size, 1);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "fillseqbatch")) {
-      benchmark_write(write_sync, SEQUENTIAL, num_, FLAGS_value_size, 1000);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "fillrandom")) {
-      benchmark_write(write_sync, RANDOM, num_, FLAGS_value_size, 1);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "fillrandbatch")) {
-      benchmark_write(write_sync, RANDOM, num_, FLAGS_value_size, 1000);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "overwrite")) {
-      benchmark_write(write_sync, RANDOM, num_, FLAGS_value_size, 1);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "overwritesync")) {
-	  write_sync = true;
-      benchmark_write(write_sync, RANDOM, num_, FLAGS_value_size, 1);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "overwritebatch")) {
-      benchmark_write(write_sync, RANDOM, num_, FLAGS_value_size, 1000);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "fillrandsync")) {
-      write_sync = true;
-      benchmark_write(write_sync, RANDOM, num_, FLAGS_value_size, 1);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "fillseqsync")) {
-      write_sync = true;
-      benchmark_write(write_sync, SEQUENTIAL, num_, FLAGS_value_size, 1);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "fillrand100K")) {
-      benchmark_write(write_sync, RANDOM, num_ / 1000, 100 * 1000, 1);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "fillseq100K")) {
-      benchmark_write(write_sync, SEQUENTIAL, num_ / 1000, 100 * 1000, 1);
-      wal_checkpoint(db_);
-    } else if (!strcmp(name, "readseq")) {
-      benchmark_read(SEQUENTIAL, 1);
-    } else if (!strcmp(name, "readrandom")) {
-      benchmark_read(RANDOM, 1);
-    } else if (!strcmp(name, "readrand100K")) {
-      int n = reads_;
-      reads_ /= 1000;
-      benchmark_read(RANDOM, 1);
-      reads_ = n;
-    } else if (!strcmp(name, "delete")) {
-      benchmark_delete(write_sync, RANDOM, 1);
-	    wal_checkpoint(db_);
-    } else if (!strcmp(name, "deletesync")) {
-      write_sync = true;
-      benchmark_delete(write_sync, RANDOM, 1);
-      wal_checkpoint(db_);
-    } else {
-      known = false;
-      if (strcmp(name, "")) {
-        fprintf(stderr, "unknown benchmark '%s'\n", name);
+
+    if (!sweeping) {
+      run_benchmark(name);
+      continue;
+    }
+    for (int c = 0; c < sweep_count(); c++) {
+      sweep_apply(c);
+      sweep_print_header();
+      num_ = FLAGS_num;
+      reads_ = FLAGS_reads < 0 ? FLAGS_num : FLAGS_reads;
+      rand_init(&rand_, seed_ + slot);
+      gen_.pos_ = 0;
+      benchmark_open();
+      if (slot == 0) {
+        sweep_record("open", 1, open_micros_, 0, 0, 0);
       }
+      run_benchmark(name);
+      benchmark_fini();
     }
-    if (known) {
-      stop(name);
+  }
+
+  sweep_report();
+}
+
+static void run_benchmark(char* name) {
+  if (if_create_database(name)) {
+    int status;
+    char* err_msg = NULL;
+    /* create tables/index for database if bench is not overwrite*/
+    char* create_stmt =
+            "CREATE TABLE test (key int, value text, PRIMARY KEY (key))";
+    status = sqlite3_exec(db_, create_stmt, NULL, NULL, &err_msg);
+    exec_error_check(status, err_msg);
+    if (FLAGS_shards > 1) {
+      shard_exec(create_stmt);
     }
   }
+  bytes_ = 0;
+  start();
+  bool known = true;
+  bool write_sync = false;
+  if (!strcmp(name, "fillseq")) {
+    benchmark_write(write_sync, SEQUENTIAL, num_, FLAGS_value_size, 1);
+    wal_checkpoint(db_);
+  } else if (!strcmp(name, "fillseqbatch")) {
+    benchmark_write(write_sync, SEQUENTIAL, num_, FLAGS_value_size, 1000);
+    wal_checkpoint(db_);
+  } else if (!strcmp(name, "fillrandom")) {
+    benchmark_write(write_sync, RANDOM, num_, FLAGS_value_size, 1);
+    wal_checkpoint(db_);
+  } else if (!strcmp(name, "fillrandbatch")) {
+    benchmark_write(write_sync, RANDOM, num_, FLAGS_value_size, 1000);
+    wal_checkpoint(db_);
+  } else if (!strcmp(name, "overwrite")) {
+    benchmark_write(write_sync, RANDOM, num_, FLAGS_value_size, 1);
+    wal_checkpoint(db_);
+  } else if (!strcmp(name, "overwritesync")) {
+	  write_sync = true;
+    benchmark_write(write_sync, RANDOM, num_, FLAGS_value_size, 1);
+    wal_checkpoint(db_);
+  } else if (!strcmp(name, "overwritebatch")) {
+    benchmark_write(write_sync, RANDOM, num_, FLAGS_value_size, 1000);
+    wal_checkpoint(db_);
+  } else if (!strcmp(name, "fillrandsync")) {
+    write_sync = true;
+    benchmark_write(write_sync, RANDOM, num_, FLAGS_value_size, 1);
+    wal_checkpoint(db_);
+  } else if (!strcmp(name, "fillseqsync")) {
+    write_sync = true;
+    benchmark_write(write_sync, SEQUENTIAL, num_, FLAGS_value_size, 1);
+    wal_checkpoint(db_);
+  } else if (!strcmp(name, "fillcontend")) {
+    benchmark_contend(write_sync, num_, FLAGS_value_size);
+    wal_checkpoint(db_);
+  } else if (!strcmp(name, "poolprivate")) {
+    benchmark_pool(false);
+  } else if (!strcmp(name, "poolshared")) {
+    benchmark_pool(true);
+  } else if (!strcmp(name, "threadmodes")) {
+    benchmark_threading_modes();
+  } else if (!strcmp(name, "openkey")) {
+    benchmark_openkey();
+  } else if (!strcmp(name, "rekey")) {
+    benchmark_rekey();
+  } else if (!strcmp(name, "export_encrypt")) {
+    benchmark_export(kExportEncrypt);
+  } else if (!strcmp(name, "export_decrypt")) {
+    benchmark_export(kExportDecrypt);
+  } else if (!strcmp(name, "export_reencrypt")) {
+    benchmark_export(kExportReencrypt);
+  } else if (!strcmp(name, "cryptobench")) {
+    benchmark_cryptobench();
+  } else if (!strcmp(name, "integrity")) {
+    benchmark_integrity(false);
+  } else if (!strcmp(name, "integrityread")) {
+    benchmark_integrity(true);
+  } else if (!strcmp(name, "attach")) {
+    benchmark_attach();
+  } else if (!strcmp(name, "fillrand100K")) {
+    benchmark_write(write_sync, RANDOM, num_ / 1000, 100 * 1000, 1);
+    wal_checkpoint(db_);
+  } else if (!strcmp(name, "fillseq100K")) {
+    benchmark_write(write_sync, SEQUENTIAL, num_ / 1000, 100 * 1000, 1);
+    wal_checkpoint(db_);
+  } else if (!strcmp(name, "readseq")) {
+    benchmark_read(SEQUENTIAL, 1);
+  } else if (!strcmp(name, "readrandom")) {
+    benchmark_read(RANDOM, 1);
+  } else if (!strcmp(name, "readrand100K")) {
+    int n = reads_;
+    reads_ /= 1000;
+    benchmark_read(RANDOM, 1);
+    reads_ = n;
+  } else if (!strcmp(name, "delete")) {
+    benchmark_delete(write_sync, RANDOM, 1);
+	    wal_checkpoint(db_);
+  } else if (!strcmp(name, "deletesync")) {
+    write_sync = true;
+    benchmark_delete(write_sync, RANDOM, 1);
+    wal_checkpoint(db_);
+  } else {
+    known = false;
+    if (strcmp(name, "")) {
+      fprintf(stderr, "unknown benchmark '%s'\n", name);
+    }
+  }
+  if (known) {
+    stop(name);
+  }
 }
 
 void benchmark_open() {
   assert(db_ == NULL);
 
-  int status;
-  char file_name[100];
-  char* err_msg = NULL;
-
   /* Open database */
   if (FLAGS_use_existing_db) {
-    snprintf(file_name, sizeof(file_name),
+    snprintf(db_file_name_, sizeof(db_file_name_),
              "%s",
              FLAGS_db);
   } else {
-      snprintf(file_name, sizeof(file_name),
-               "%sdbbench_sqlite3.db",
-               FLAGS_db);
+      char suffix[20];
+      sweep_file_suffix(suffix, sizeof(suffix));
+      snprintf(db_file_name_, sizeof(db_file_name_),
+               "%sdbbench_sqlite3%s.db",
+               FLAGS_db, suffix);
   }
-  status = sqlite3_open(file_name, &db_);
+  /*
+   * The key is derived on the first read of the database, so the open
+   * latency includes reading the schema.
+   */
+  double start = now_micros();
+  db_ = benchmark_open_db(db_file_name_, 0, true);
+  char* err_msg = NULL;
+  int status = sqlite3_exec(db_, "SELECT count(*) FROM sqlite_master", NULL,
+                            NULL, &err_msg);
+  exec_error_check(status, err_msg);
+  open_micros_ = now_micros() - start;
+  fprintf(stderr, "%-12s : %.3f micros (%s key);\n", "open", open_micros_,
+          FLAGS_use_sqlcipher ? FLAGS_key_mode : "no");
+
+  if (FLAGS_shards > 1) {
+    shard_open();
+  }
+}
+
+/*
+ * Open file_name with the extra SQLITE_OPEN_* open_flags and apply the key
+ * and the PRAGMAs selected by the flags.  Connections that share a file
+ * with other connections must not take the exclusive lock.
+ */
+sqlite3* benchmark_open_db(const char* file_name, int open_flags,
+                           bool exclusive) {
+  sqlite3* db;
+  int status;
+
+  status = storage_open(file_name, &db,
+                        SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE |
+                        threading_open_flags() | open_flags);
   if (status) {
-    fprintf(stderr, "open error: %s\n", sqlite3_errmsg(db_));
+    fprintf(stderr, "open error: %s\n", sqlite3_errmsg(db));
     exit(1);
   }
+  /* The setup PRAGMAs below may meet a lock held by another connection */
+  busy_install(db);
 
   /* Input Key */
   if(FLAGS_use_sqlcipher) {
-    status = sqlite3_key(db_, FLAGS_key, strlen(FLAGS_key));
-    if (status) {
-      fprintf(stderr, "input key error: %s\n", sqlite3_errmsg(db_));
-      exit(1);
-    }
+    benchmark_key(db);
   }
 
   /* Change SQLite cache size */
   char cache_size[100];
   snprintf(cache_size, sizeof(cache_size), "PRAGMA cache_size = %d",
             FLAGS_num_pages);
-  status = sqlite3_exec(db_, cache_size, NULL, NULL, &err_msg);
-  exec_error_check(status, err_msg);
+  busy_exec(db, cache_size);
 
   /* FLAGS_page_size is defaulted to 1024 */
   if (FLAGS_page_size != 1024) {
     char page_size[100];
     snprintf(page_size, sizeof(page_size), "PRAGMA page_size = %d",
               FLAGS_page_size);
-    status = sqlite3_exec(db_, page_size, NULL, NULL, &err_msg);
-    exec_error_check(status, err_msg);
+    busy_exec(db, page_size);
   }
 
-  /* Change journal mode to WAL if WAL enabled flag is on */
-  if (FLAGS_WAL_enabled) {
+  if (FLAGS_mmap_size >= 0) {
+    char mmap_size[100];
+    snprintf(mmap_size, sizeof(mmap_size), "PRAGMA mmap_size = %" PRId64,
+             FLAGS_mmap_size);
+    busy_exec(db, mmap_size);
+  }
+
+  /* Journal, sorts and statement journals in memory, as memdb has them */
+  if (storage_journal_in_memory()) {
+    busy_exec(db, "PRAGMA journal_mode = MEMORY");
+    busy_exec(db, "PRAGMA temp_store = MEMORY");
+  } else if (FLAGS_WAL_enabled) {
+    /* Change journal mode to WAL if WAL enabled flag is on */
     char* WAL_stmt = "PRAGMA journal_mode = WAL";
 
     /* Default cache size is a combined 4 MB */
     char* WAL_checkpoint = "PRAGMA wal_autocheckpoint = 4096";
-    status = sqlite3_exec(db_, WAL_stmt, NULL, NULL, &err_msg);
+    busy_exec(db, WAL_stmt);
+    busy_exec(db, WAL_checkpoint);
+  }
+
+  /* Change locking mode to exclusive */
+  if (exclusive) {
+    char* locking_stmt = "PRAGMA locking_mode = EXCLUSIVE";
+    busy_exec(db, locking_stmt);
+  }
+
+  return db;
+}
+
+/*
+ * The key as handed to sqlite3_key() under FLAGS_key_mode, to be freed
+ * with sqlite3_free().  A passphrase goes through PBKDF2 on the first
+ * access, a raw key x'...' is used as is, and a raw key with salt also
+ * skips reading the salt from the file header.
+ */
+char* benchmark_key_string() {
+  if (strcmp(FLAGS_key_mode, "passphrase")) {
+    bool with_salt = !strcmp(FLAGS_key_mode, "raw_with_salt");
+    if (!is_hex(FLAGS_key, 64)) {
+      fprintf(stderr, "--key_mode=%s needs --key as 64 hex digits\n",
+              FLAGS_key_mode);
+      exit(1);
+    }
+    if (with_salt && (FLAGS_key_salt == NULL || !is_hex(FLAGS_key_salt, 32))) {
+      fprintf(stderr, "--key_mode=%s needs --key_salt as 32 hex digits\n",
+              FLAGS_key_mode);
+      exit(1);
+    }
+    return sqlite3_mprintf("x'%s%s'", FLAGS_key,
+                           with_salt ? FLAGS_key_salt : "");
+  }
+
+  return sqlite3_mprintf("%s", FLAGS_key);
+}
+
+/*
+ * Key db according to FLAGS_key_mode and apply the cipher settings.
+ */
+void benchmark_key(sqlite3* db) {
+  char* key = benchmark_key_string();
+  int status = sqlite3_key(db, key, strlen(key));
+  if (status) {
+    fprintf(stderr, "input key error: %s\n", sqlite3_errmsg(db));
+    exit(1);
+  }
+  sqlite3_free(key);
+  apply_cipher_settings(db);
+}
+
+/*
+ * Cipher settings take effect between sqlite3_key() and the first access
+ * to the database.  cipher_compatibility resets the others, so it goes
+ * first.
+ */
+static void apply_cipher_settings(sqlite3* db) {
+  char stmt[100];
+  char* err_msg = NULL;
+  int status;
+
+  if (FLAGS_cipher_compatibility > 0) {
+    snprintf(stmt, sizeof(stmt), "PRAGMA cipher_compatibility = %d",
+             FLAGS_cipher_compatibility);
+    status = sqlite3_exec(db, stmt, NULL, NULL, &err_msg);
+    exec_error_check(status, err_msg);
+  }
+  if (FLAGS_cipher_page_size > 0) {
+    snprintf(stmt, sizeof(stmt), "PRAGMA cipher_page_size = %d",
+             FLAGS_cipher_page_size);
+    status = sqlite3_exec(db, stmt, NULL, NULL, &err_msg);
     exec_error_check(status, err_msg);
-    status = sqlite3_exec(db_, WAL_checkpoint, NULL, NULL, &err_msg);
+  }
+  if (FLAGS_kdf_iter > 0) {
+    snprintf(stmt, sizeof(stmt), "PRAGMA kdf_iter = %d", FLAGS_kdf_iter);
+    status = sqlite3_exec(db, stmt, NULL, NULL, &err_msg);
+    exec_error_check(status, err_msg);
+  }
+  if (FLAGS_cipher_hmac_algorithm != NULL) {
+    snprintf(stmt, sizeof(stmt), "PRAGMA cipher_hmac_algorithm = %s",
+             FLAGS_cipher_hmac_algorithm);
+    status = sqlite3_exec(db, stmt, NULL, NULL, &err_msg);
+    exec_error_check(status, err_msg);
+  }
+  if (FLAGS_cipher_kdf_algorithm != NULL) {
+    snprintf(stmt, sizeof(stmt), "PRAGMA cipher_kdf_algorithm = %s",
+             FLAGS_cipher_kdf_algorithm);
+    status = sqlite3_exec(db, stmt, NULL, NULL, &err_msg);
+    exec_error_check(status, err_msg);
+  }
+  if (FLAGS_cipher_use_hmac >= 0) {
+    snprintf(stmt, sizeof(stmt), "PRAGMA cipher_use_hmac = %s",
+             FLAGS_cipher_use_hmac ? "ON" : "OFF");
+    status = sqlite3_exec(db, stmt, NULL, NULL, &err_msg);
+    exec_error_check(status, err_msg);
+  }
+  if (FLAGS_cipher_plaintext_header_size >= 0) {
+    snprintf(stmt, sizeof(stmt), "PRAGMA cipher_plaintext_header_size = %d",
+             FLAGS_cipher_plaintext_header_size);
+    status = sqlite3_exec(db, stmt, NULL, NULL, &err_msg);
+    exec_error_check(status, err_msg);
+  }
+  if (FLAGS_cipher_plaintext_header_size > 0) {
+    snprintf(stmt, sizeof(stmt), "PRAGMA cipher_salt = \"x'%s'\"",
+             cipher_salt());
+    status = sqlite3_exec(db, stmt, NULL, NULL, &err_msg);
     exec_error_check(status, err_msg);
   }
+}
 
-  /* Change locking mode to exclusive */
-  char* locking_stmt = "PRAGMA locking_mode = EXCLUSIVE";
-  status = sqlite3_exec(db_, locking_stmt, NULL, NULL, &err_msg);
-  exec_error_check(status, err_msg);
+/*
+ * With a plaintext header the salt is not stored in the file, so every
+ * connection to the same database must be given the same one.
+ */
+static const char* cipher_salt() {
+  return FLAGS_cipher_salt != NULL ? FLAGS_cipher_salt
+                                   : "00112233445566778899AABBCCDDEEFF";
+}
+
+/*
+ * db_ holds the exclusive lock on the main database, so it is closed while
+ * benchmarks with several connections to that file run.
+ */
+static void close_main_db() {
+  int status = sqlite3_close(db_);
+  error_check(status);
+  db_ = NULL;
+}
+
+static void reopen_main_db() {
+  db_ = benchmark_open_db(db_file_name_, 0, true);
+}
+
+static void benchmark_contend(bool write_sync, int num_entries,
+                              int value_size) {
+  close_main_db();
+
+  ThreadStats total;
+  contend_write(db_file_name_, write_sync, num_entries, value_size, &total);
+  add_thread_stats(&total);
+
+  reopen_main_db();
+}
+
+static void benchmark_pool(bool shared_cache) {
+  close_main_db();
+
+  ThreadStats total;
+  pool_read(db_file_name_, shared_cache, num_, reads_, &total);
+  add_thread_stats(&total);
+
+  reopen_main_db();
+}
+
+/*
+ * Switching threading modes shuts SQLite down, which needs every
+ * connection closed, shards included.
+ */
+static void benchmark_threading_modes() {
+  close_main_db();
+  if (FLAGS_shards > 1) {
+    shard_close();
+  }
+
+  ThreadStats total;
+  threading_sweep(db_file_name_, num_, reads_, &total);
+  add_thread_stats(&total);
+
+  reopen_main_db();
+  if (FLAGS_shards > 1) {
+    shard_open();
+  }
+}
+
+static void benchmark_openkey() {
+  close_main_db();
+
+  ThreadStats total;
+  openkey_run(db_file_name_, FLAGS_opens, &total);
+  add_thread_stats(&total);
+
+  reopen_main_db();
+}
+
+static void benchmark_rekey() {
+  close_main_db();
+
+  ThreadStats total;
+  rekey_run(db_file_name_, &total);
+  add_thread_stats(&total);
+
+  reopen_main_db();
+}
+
+static void benchmark_export(int mode) {
+  close_main_db();
+
+  ThreadStats total;
+  export_run(db_file_name_, mode, &total);
+  add_thread_stats(&total);
+
+  reopen_main_db();
+}
+
+static void benchmark_cryptobench() {
+  ThreadStats total;
+  cryptobench_run(&total);
+  add_thread_stats(&total);
+}
+
+static void benchmark_integrity(bool with_reads) {
+  close_main_db();
+
+  ThreadStats total;
+  if (with_reads) {
+    integrity_read(db_file_name_, num_, reads_, &total);
+  } else {
+    integrity_run(db_file_name_, &total);
+  }
+  add_thread_stats(&total);
+
+  reopen_main_db();
+}
+
+static void benchmark_attach() {
+  close_main_db();
+
+  ThreadStats total;
+  attach_run(db_file_name_, FLAGS_attach, num_, reads_, &total);
+  add_thread_stats(&total);
+
+  reopen_main_db();
 }
 
 void benchmark_write(bool write_sync, int order, int num_entries, int value_size, int entries_per_batch) {
@@ -387,6 +880,19 @@ void benchmark_write(bool write_sync, int order, int num_entries, int value_size
     message_ = msg;
   }
 
+  if (FLAGS_shards > 1) {
+    ThreadStats total;
+    shard_write(write_sync, order, num_entries, value_size, &total);
+    add_thread_stats(&total);
+    return;
+  }
+
+  if (FLAGS_pipeline_threads > 0) {
+    benchmark_write_pipelined(write_sync, order, num_entries, value_size,
+                              entries_per_batch);
+    return;
+  }
+
   char* err_msg = NULL;
   int status;
 
@@ -475,7 +981,113 @@ void benchmark_write(bool write_sync, int order, int num_entries, int value_size
   error_check(status);
 }
 
+/*
+ * Same as benchmark_write, but keys and values are produced by
+ * FLAGS_pipeline_threads generator threads while this thread writes, so
+ * memory stays bounded by FLAGS_pipeline_depth batches.
+ */
+static void benchmark_write_pipelined(bool write_sync, int order,
+                                      int num_entries, int value_size,
+                                      int entries_per_batch) {
+  char* err_msg = NULL;
+  int status;
+
+  sqlite3_stmt *replace_stmt, *begin_trans_stmt, *end_trans_stmt;
+  char* replace_str = "REPLACE INTO test (key, value) VALUES (?, ?)";
+  char *begin_trans_str = "BEGIN TRANSACTION";
+  char *end_trans_str = "END TRANSACTION";
+
+  /* Check for synchronous flag in options */
+  char* sync_stmt = (write_sync) ? "PRAGMA synchronous = FULL" :
+                                    "PRAGMA synchronous = OFF";
+  status = sqlite3_exec(db_, sync_stmt, NULL, NULL, &err_msg);
+  exec_error_check(status, err_msg);
+
+  /* Preparing sqlite3 statements */
+  status = sqlite3_prepare_v2(db_, replace_str, -1,
+                              &replace_stmt, NULL);
+  error_check(status);
+  status = sqlite3_prepare_v2(db_, begin_trans_str, -1,
+                              &begin_trans_stmt, NULL);
+  error_check(status);
+  status = sqlite3_prepare_v2(db_, end_trans_str, -1,
+                              &end_trans_stmt, NULL);
+  error_check(status);
+
+  /* Chunks and transactions as in benchmark_write */
+  for (int n = num_entries > MAXNUMPERTIME ? MAXNUMPERTIME : num_entries; n > 0; n -= MAXNUMPERTIME) {
+    Pipeline pipeline;
+    double start = now_micros();
+    pipeline_start(&pipeline, &gen_, rand_next(&rand_), FLAGS_pipeline_threads,
+                   FLAGS_pipeline_depth, order, n, value_size,
+                   entries_per_batch);
+
+    /* Begin write transaction */
+    if (FLAGS_transaction) {
+      status = sqlite3_step(begin_trans_stmt);
+      step_error_check(status);
+      status = sqlite3_reset(begin_trans_stmt);
+      error_check(status);
+    }
+
+    Batch* batch;
+    while ((batch = pipeline_next(&pipeline)) != NULL) {
+      for (int i = 0; i < batch->num_; i += entries_per_batch) {
+        for (int j = 0; j < entries_per_batch && i + j < batch->num_; j++) {
+          /* Bind KV values into replace_stmt */
+          status = sqlite3_bind_int(replace_stmt, 1, batch->keys_[i+j]);
+          error_check(status);
+          status = sqlite3_bind_blob(replace_stmt, 2,
+                                     batch->values_ + (i+j) * value_size,
+                                     value_size, SQLITE_STATIC);
+          error_check(status);
+
+          /* Execute replace_stmt */
+          bytes_ += value_size + sizeof(int);
+          status = sqlite3_step(replace_stmt);
+          step_error_check(status);
+
+          /* Reset SQLite statement for another use */
+          status = sqlite3_clear_bindings(replace_stmt);
+          error_check(status);
+          status = sqlite3_reset(replace_stmt);
+          error_check(status);
+
+          finish_single_op();
+        }
+      }
+      batch_free(batch);
+    }
+
+    /* End write transaction */
+    if (FLAGS_transaction) {
+      status = sqlite3_step(end_trans_stmt);
+      step_error_check(status);
+      status = sqlite3_reset(end_trans_stmt);
+      error_check(status);
+    }
+
+    double end = now_micros();
+    op_total_time_ += end - start;
+    pipeline_stop(&pipeline, end - start);
+  }
+
+  status = sqlite3_finalize(replace_stmt);
+  error_check(status);
+  status = sqlite3_finalize(begin_trans_stmt);
+  error_check(status);
+  status = sqlite3_finalize(end_trans_stmt);
+  error_check(status);
+}
+
 void benchmark_read(int order, int entries_per_batch) {
+  if (FLAGS_shards > 1) {
+    ThreadStats total;
+    shard_read(order, num_, reads_, &total);
+    add_thread_stats(&total);
+    return;
+  }
+
   int status;
   sqlite3_stmt *read_stmt, *begin_trans_stmt, *end_trans_stmt;
 
@@ -0,0 +1,161 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+enum BusyStrategy {
+  BUSY_NONE,
+  BUSY_TIMEOUT,
+  BUSY_BACKOFF,
+  BUSY_RETRY
+};
+
+/* Counters shared by every connection, updated atomically */
+static int64_t busy_events_;
+static int64_t busy_retries_;
+static int64_t busy_wait_micros_;
+static int64_t busy_failed_txns_;
+
+/* Start of the busy episode the calling thread is waiting in */
+static __thread double wait_start_;
+
+static int busy_strategy(void);
+static int busy_handler(void*, int);
+
+static int busy_strategy() {
+  if (!strcmp(FLAGS_busy_strategy, "timeout")) return BUSY_TIMEOUT;
+  if (!strcmp(FLAGS_busy_strategy, "backoff")) return BUSY_BACKOFF;
+  if (!strcmp(FLAGS_busy_strategy, "retry")) return BUSY_RETRY;
+  return BUSY_NONE;
+}
+
+/*
+ * sqlite3_busy_handler callback.  "timeout" sleeps on the same schedule as
+ * SQLite's built-in sqlite3_busy_timeout() handler, "backoff" doubles the
+ * delay on every retry.  Both give up after FLAGS_busy_timeout ms.
+ */
+static int busy_handler(void* arg, int count) {
+  static const int delays[] = { 1, 2, 5, 10, 15, 20, 25, 25, 25, 50, 50, 100 };
+  const int num_delays = sizeof(delays) / sizeof(delays[0]);
+  double now = now_micros();
+
+  if (count == 0) {
+    wait_start_ = now;
+    __atomic_add_fetch(&busy_events_, 1, __ATOMIC_RELAXED);
+  }
+  if (now - wait_start_ >= FLAGS_busy_timeout * 1000.0) {
+    return 0;
+  }
+
+  int delay;
+  if ((intptr_t)arg == BUSY_TIMEOUT) {
+    delay = delays[count < num_delays ? count : num_delays - 1];
+  } else {
+    delay = count < 7 ? 1 << count : 100;
+  }
+  sqlite3_sleep(delay);
+
+  __atomic_add_fetch(&busy_retries_, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&busy_wait_micros_, (int64_t)(now_micros() - now),
+                     __ATOMIC_RELAXED);
+
+  return 1;
+}
+
+void busy_install(sqlite3* db) {
+  int strategy = busy_strategy();
+
+  if (strategy == BUSY_TIMEOUT || strategy == BUSY_BACKOFF) {
+    int status = sqlite3_busy_handler(db, busy_handler,
+                                      (void*)(intptr_t)strategy);
+    error_check(status);
+  }
+}
+
+/*
+ * sqlite3_step() that records lock contention.  SQLITE_LOCKED, and
+ * SQLITE_BUSY under the "retry" strategy, are retried immediately until
+ * FLAGS_busy_timeout ms have passed.  Returns the final status.
+ */
+int busy_step(sqlite3_stmt* stmt) {
+  int status = sqlite3_step(stmt);
+  if (status != SQLITE_BUSY && status != SQLITE_LOCKED) {
+    return status;
+  }
+
+  int strategy = busy_strategy();
+  if (status == SQLITE_BUSY &&
+      (strategy == BUSY_TIMEOUT || strategy == BUSY_BACKOFF)) {
+    /* The busy handler has already recorded and waited out this event */
+    return status;
+  }
+
+  __atomic_add_fetch(&busy_events_, 1, __ATOMIC_RELAXED);
+  if (strategy == BUSY_NONE) {
+    return status;
+  }
+
+  double start = now_micros();
+  do {
+    sched_yield();
+    sqlite3_reset(stmt);
+    __atomic_add_fetch(&busy_retries_, 1, __ATOMIC_RELAXED);
+    status = sqlite3_step(stmt);
+  } while ((status == SQLITE_BUSY || status == SQLITE_LOCKED) &&
+           now_micros() - start < FLAGS_busy_timeout * 1000.0);
+  __atomic_add_fetch(&busy_wait_micros_, (int64_t)(now_micros() - start),
+                     __ATOMIC_RELAXED);
+
+  return status;
+}
+
+/*
+ * sqlite3_exec() of a PRAGMA that sets a connection up, which must not
+ * kill the run because another connection holds a lock.  SQLITE_BUSY and
+ * SQLITE_LOCKED are retried as under the "retry" strategy whatever
+ * --busy_strategy is, until FLAGS_busy_timeout ms have passed.  Exits on
+ * any other error or once the time is up.
+ */
+void busy_exec(sqlite3* db, const char* sql) {
+  char* err_msg = NULL;
+  int status = sqlite3_exec(db, sql, NULL, NULL, &err_msg);
+  if (status == SQLITE_BUSY || status == SQLITE_LOCKED) {
+    double start = now_micros();
+    __atomic_add_fetch(&busy_events_, 1, __ATOMIC_RELAXED);
+    do {
+      sqlite3_free(err_msg);
+      err_msg = NULL;
+      sched_yield();
+      __atomic_add_fetch(&busy_retries_, 1, __ATOMIC_RELAXED);
+      status = sqlite3_exec(db, sql, NULL, NULL, &err_msg);
+    } while ((status == SQLITE_BUSY || status == SQLITE_LOCKED) &&
+             now_micros() - start < FLAGS_busy_timeout * 1000.0);
+    __atomic_add_fetch(&busy_wait_micros_, (int64_t)(now_micros() - start),
+                       __ATOMIC_RELAXED);
+  }
+  exec_error_check(status, err_msg);
+}
+
+void busy_failed_txn() {
+  __atomic_add_fetch(&busy_failed_txns_, 1, __ATOMIC_RELAXED);
+}
+
+void busy_reset() {
+  __atomic_store_n(&busy_events_, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&busy_retries_, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&busy_wait_micros_, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&busy_failed_txns_, 0, __ATOMIC_RELAXED);
+}
+
+void busy_report(const char* name) {
+  if (busy_events_ == 0 && busy_failed_txns_ == 0) {
+    return;
+  }
+
+  fprintf(stderr, "%-12s : %" PRId64 " busy events, %" PRId64 " retries, "
+          "%.3f micros waiting (%s);\n", name, busy_events_, busy_retries_,
+          (double)busy_wait_micros_, FLAGS_busy_strategy);
+  fprintf(stderr, "%-12s : %" PRId64 " failed transactions;\n", name,
+          busy_failed_txns_);
+}
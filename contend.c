@@ -0,0 +1,158 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+/* Number of rows written per transaction */
+#define kContendBatch 100
+
+typedef struct ContendWorker {
+  pthread_t thread_;
+  const char* file_name_;
+  bool write_sync_;
+  int num_keys_;
+  int num_ops_;
+  int value_size_;
+  Random rand_;
+  RandomGenerator gen_;
+  ThreadStats stats_;
+} ContendWorker;
+
+static void* contend_main(void*);
+static void contend_rollback(sqlite3*);
+
+static void contend_rollback(sqlite3* db) {
+  /* Fails harmlessly if the transaction was never started */
+  sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+  busy_failed_txn();
+}
+
+static void* contend_main(void* arg) {
+  ContendWorker* w = arg;
+  sqlite3* db = benchmark_open_db(w->file_name_, 0, false);
+  char* err_msg = NULL;
+  int status;
+
+  sqlite3_stmt *replace_stmt, *begin_trans_stmt, *end_trans_stmt;
+  char* replace_str = "REPLACE INTO test (key, value) VALUES (?, ?)";
+  char *begin_trans_str = "BEGIN IMMEDIATE TRANSACTION";
+  char *end_trans_str = "COMMIT TRANSACTION";
+
+  /* Check for synchronous flag in options */
+  char* sync_stmt = (w->write_sync_) ? "PRAGMA synchronous = FULL" :
+                                       "PRAGMA synchronous = OFF";
+  status = sqlite3_exec(db, sync_stmt, NULL, NULL, &err_msg);
+  exec_error_check(status, err_msg);
+
+  /* Preparing sqlite3 statements */
+  status = sqlite3_prepare_v2(db, replace_str, -1, &replace_stmt, NULL);
+  error_check(status);
+  status = sqlite3_prepare_v2(db, begin_trans_str, -1, &begin_trans_stmt,
+                              NULL);
+  error_check(status);
+  status = sqlite3_prepare_v2(db, end_trans_str, -1, &end_trans_stmt, NULL);
+  error_check(status);
+
+  char* value = malloc(sizeof(char) * w->value_size_);
+  db_pages(db, true);
+  double start = now_micros();
+
+  /* Rows of a failed transaction are dropped, not retried */
+  for (int attempted = 0; attempted < w->num_ops_;
+       attempted += kContendBatch) {
+    int n = w->num_ops_ - attempted;
+    if (n > kContendBatch) n = kContendBatch;
+
+    status = busy_step(begin_trans_stmt);
+    sqlite3_reset(begin_trans_stmt);
+    if (status != SQLITE_DONE) {
+      busy_failed_txn();
+      continue;
+    }
+
+    bool failed = false;
+    for (int i = 0; i < n && !failed; i++) {
+      rand_gen_fill(&w->gen_, value, w->value_size_);
+
+      /* Bind KV values into replace_stmt */
+      status = sqlite3_bind_int(replace_stmt, 1,
+                                rand_next(&w->rand_) % w->num_keys_);
+      error_check(status);
+      status = sqlite3_bind_blob(replace_stmt, 2, value, w->value_size_,
+                                 SQLITE_STATIC);
+      error_check(status);
+
+      status = busy_step(replace_stmt);
+      sqlite3_reset(replace_stmt);
+      failed = status != SQLITE_DONE;
+    }
+
+    if (!failed) {
+      status = busy_step(end_trans_stmt);
+      sqlite3_reset(end_trans_stmt);
+      failed = status != SQLITE_DONE;
+    }
+
+    if (failed) {
+      contend_rollback(db);
+    } else {
+      w->stats_.done_ += n;
+      w->stats_.bytes_ += (int64_t)n * (w->value_size_ + sizeof(int));
+    }
+  }
+
+  w->stats_.micros_ = now_micros() - start;
+  w->stats_.pages_ = db_pages(db, false);
+  free(value);
+
+  status = sqlite3_finalize(replace_stmt);
+  error_check(status);
+  status = sqlite3_finalize(begin_trans_stmt);
+  error_check(status);
+  status = sqlite3_finalize(end_trans_stmt);
+  error_check(status);
+  status = sqlite3_close(db);
+  error_check(status);
+
+  return NULL;
+}
+
+/*
+ * Write num_entries random rows into file_name from FLAGS_threads
+ * connections at once, kContendBatch rows per transaction.  Lock waits are
+ * handled by FLAGS_busy_strategy and counted by busy.c.
+ */
+void contend_write(const char* file_name, bool write_sync, int num_entries,
+                   int value_size, ThreadStats* total) {
+  int num_threads = FLAGS_threads;
+  ContendWorker* workers = calloc(sizeof(ContendWorker), num_threads);
+
+  for (int i = 0; i < num_threads; i++) {
+    ContendWorker* w = &workers[i];
+    w->file_name_ = file_name;
+    w->write_sync_ = write_sync;
+    w->num_keys_ = num_entries;
+    w->num_ops_ = num_entries / num_threads + (i < num_entries % num_threads);
+    w->value_size_ = value_size;
+    rand_init(&w->rand_, rand_next(&rand_));
+    /* Share the generator's data, but read it from a different offset */
+    w->gen_ = gen_;
+    w->gen_.pos_ = rand_uniform(&w->rand_, (int)gen_.data_size_);
+  }
+
+  double start = now_micros();
+  for (int i = 0; i < num_threads; i++) {
+    thread_create(&workers[i].thread_, i + 1, contend_main, &workers[i]);
+  }
+  memset(total, 0, sizeof(ThreadStats));
+  for (int i = 0; i < num_threads; i++) {
+    pthread_join(workers[i].thread_, NULL);
+    total->done_ += workers[i].stats_.done_;
+    total->bytes_ += workers[i].stats_.bytes_;
+    total->pages_ += workers[i].stats_.pages_;
+  }
+  total->micros_ = now_micros() - start;
+
+  free(workers);
+}
@@ -0,0 +1,253 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define HAVE_RDTSC 1
+#endif
+
+/* Bytes each thread encrypts, and then decrypts, per page size */
+#define kCryptoBytes (32 * 1048576)
+
+/* Reserved bytes at the end of a SQLCipher 4 page: IV, then HMAC-SHA512 */
+#define kIvSize 16
+#define kHmacSize 64
+#define kReserveSize (kIvSize + kHmacSize)
+
+typedef struct CryptoWorker {
+  pthread_t thread_;
+  int page_size_;
+  int num_pages_;
+  unsigned char key_[32];
+  unsigned char hmac_key_[32];
+  double enc_micros_;
+  double dec_micros_;
+  uint64_t enc_cycles_;
+  uint64_t dec_cycles_;
+} CryptoWorker;
+
+/*
+ * HMAC-SHA512 over the ciphertext and IV of a page followed by its page
+ * number, the way SQLCipher authenticates a page.
+ */
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+
+typedef struct CryptoMac {
+  EVP_MAC* mac_;
+  EVP_MAC_CTX* ctx_;
+} CryptoMac;
+
+static void mac_init(CryptoMac* m) {
+  m->mac_ = EVP_MAC_fetch(NULL, "HMAC", NULL);
+  m->ctx_ = EVP_MAC_CTX_new(m->mac_);
+}
+
+static void mac_page(CryptoMac* m, const unsigned char* key,
+                     const unsigned char* in, int in_size, uint32_t pgno,
+                     unsigned char* out) {
+  OSSL_PARAM params[2];
+  size_t out_size;
+  params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+                                               "SHA512", 0);
+  params[1] = OSSL_PARAM_construct_end();
+  EVP_MAC_init(m->ctx_, key, 32, params);
+  EVP_MAC_update(m->ctx_, in, in_size);
+  EVP_MAC_update(m->ctx_, (const unsigned char*)&pgno, sizeof(pgno));
+  EVP_MAC_final(m->ctx_, out, &out_size, kHmacSize);
+}
+
+static void mac_free(CryptoMac* m) {
+  EVP_MAC_CTX_free(m->ctx_);
+  EVP_MAC_free(m->mac_);
+}
+#else
+typedef struct CryptoMac {
+  HMAC_CTX* ctx_;
+} CryptoMac;
+
+static void mac_init(CryptoMac* m) {
+  m->ctx_ = HMAC_CTX_new();
+}
+
+static void mac_page(CryptoMac* m, const unsigned char* key,
+                     const unsigned char* in, int in_size, uint32_t pgno,
+                     unsigned char* out) {
+  unsigned int out_size;
+  HMAC_Init_ex(m->ctx_, key, 32, EVP_sha512(), NULL);
+  HMAC_Update(m->ctx_, in, in_size);
+  HMAC_Update(m->ctx_, (const unsigned char*)&pgno, sizeof(pgno));
+  HMAC_Final(m->ctx_, out, &out_size);
+}
+
+static void mac_free(CryptoMac* m) {
+  HMAC_CTX_free(m->ctx_);
+}
+#endif
+
+static uint64_t cycles() {
+#ifdef HAVE_RDTSC
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+static void crypto_error(const char* what) {
+  fprintf(stderr, "cryptobench  : %s failed\n", what);
+  exit(1);
+}
+
+/*
+ * Encrypt num_pages_ pages the way SQLCipher writes them: a fresh random
+ * IV, AES-256-CBC over the page less its reserve, and an HMAC over the
+ * result.  Then decrypt them the way it reads them: check the HMAC and
+ * decrypt.  Both directions are timed in microseconds and TSC cycles.
+ */
+static void* crypto_main(void* arg) {
+  CryptoWorker* w = arg;
+  const int data_size = w->page_size_ - kReserveSize;
+  unsigned char* plain = malloc(w->page_size_);
+  unsigned char* pages = malloc((size_t)w->page_size_ * w->num_pages_);
+  unsigned char hmac[kHmacSize];
+  int out_size;
+
+  EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+  CryptoMac mac;
+  mac_init(&mac);
+  RAND_bytes(plain, w->page_size_);
+
+  double start = now_micros();
+  uint64_t start_cycles = cycles();
+  for (int p = 0; p < w->num_pages_; p++) {
+    unsigned char* page = pages + (size_t)p * w->page_size_;
+    unsigned char* iv = page + data_size;
+    if (RAND_bytes(iv, kIvSize) != 1) crypto_error("RAND_bytes");
+    if (!EVP_CipherInit_ex(ctx, EVP_aes_256_cbc(), NULL, w->key_, iv, 1)) {
+      crypto_error("EVP_CipherInit_ex");
+    }
+    EVP_CIPHER_CTX_set_padding(ctx, 0);
+    EVP_CipherUpdate(ctx, page, &out_size, plain, data_size);
+    EVP_CipherFinal_ex(ctx, page + out_size, &out_size);
+    mac_page(&mac, w->hmac_key_, page, data_size + kIvSize, p + 1,
+             page + data_size + kIvSize);
+  }
+  w->enc_cycles_ = cycles() - start_cycles;
+  w->enc_micros_ = now_micros() - start;
+
+  start = now_micros();
+  start_cycles = cycles();
+  for (int p = 0; p < w->num_pages_; p++) {
+    unsigned char* page = pages + (size_t)p * w->page_size_;
+    unsigned char* iv = page + data_size;
+    mac_page(&mac, w->hmac_key_, page, data_size + kIvSize, p + 1, hmac);
+    if (CRYPTO_memcmp(hmac, page + data_size + kIvSize, kHmacSize)) {
+      crypto_error("HMAC check");
+    }
+    if (!EVP_CipherInit_ex(ctx, EVP_aes_256_cbc(), NULL, w->key_, iv, 0)) {
+      crypto_error("EVP_CipherInit_ex");
+    }
+    EVP_CIPHER_CTX_set_padding(ctx, 0);
+    EVP_CipherUpdate(ctx, plain, &out_size, page, data_size);
+    EVP_CipherFinal_ex(ctx, plain + out_size, &out_size);
+  }
+  w->dec_cycles_ = cycles() - start_cycles;
+  w->dec_micros_ = now_micros() - start;
+
+  mac_free(&mac);
+  EVP_CIPHER_CTX_free(ctx);
+  free(pages);
+  free(plain);
+  return NULL;
+}
+
+static void print_cpu_features() {
+  bool aes = false, vaes = false, sha = false;
+#ifdef HAVE_RDTSC
+  unsigned int eax, ebx, ecx, edx;
+  if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    aes = (ecx & bit_AES) != 0;
+  }
+  if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+    vaes = (ecx & (1u << 9)) != 0;
+    sha = (ebx & (1u << 29)) != 0;
+  }
+#endif
+  fprintf(stderr, "%-12s : %s, AES-NI %s, VAES %s, SHA %s;\n", "cryptobench",
+          OpenSSL_version(OPENSSL_VERSION), aes ? "yes" : "no",
+          vaes ? "yes" : "no", sha ? "yes" : "no");
+}
+
+static void print_run(const char* what, int page_size, int threads,
+                      double micros, uint64_t cycles, int64_t bytes) {
+  /* micros is the slowest thread, cycles the sum over all threads */
+  fprintf(stderr, "%-12s : %5d bytes/page, %d thread%s, %s %.2f GB/s",
+          "cryptobench", page_size, threads, threads > 1 ? "s" : "", what,
+          micros > 0 ? (bytes / 1e9) / (micros / 1e6) : 0.0);
+#ifdef HAVE_RDTSC
+  fprintf(stderr, ", %.2f cycles/byte", bytes > 0 ? (double)cycles / bytes
+                                                  : 0.0);
+#endif
+  fprintf(stderr, ";\n");
+}
+
+/*
+ * Encrypt and decrypt page-sized buffers with the primitives of SQLCipher 4
+ * (AES-256-CBC and HMAC-SHA512 through OpenSSL) for every page size from
+ * 1K to 64K, from one thread and from FLAGS_threads threads, with no
+ * database involved.  That is the bound readseq and fillseq MB/s can be
+ * held against.  One op per page encrypted or decrypted.
+ */
+void cryptobench_run(ThreadStats* total) {
+  memset(total, 0, sizeof(ThreadStats));
+  print_cpu_features();
+
+  int runs[2] = { 1, FLAGS_threads };
+  int num_runs = FLAGS_threads == 1 ? 1 : 2;
+  for (int page_size = 1024; page_size <= 65536; page_size *= 2) {
+    for (int r = 0; r < num_runs; r++) {
+      int threads = runs[r];
+      CryptoWorker* workers = calloc(sizeof(CryptoWorker), threads);
+      for (int i = 0; i < threads; i++) {
+        CryptoWorker* w = &workers[i];
+        w->page_size_ = page_size;
+        w->num_pages_ = kCryptoBytes / page_size;
+        RAND_bytes(w->key_, sizeof(w->key_));
+        RAND_bytes(w->hmac_key_, sizeof(w->hmac_key_));
+      }
+      for (int i = 0; i < threads; i++) {
+        thread_create(&workers[i].thread_, i + 1, crypto_main, &workers[i]);
+      }
+
+      double enc_micros = 0, dec_micros = 0;
+      uint64_t enc_cycles = 0, dec_cycles = 0;
+      int64_t pages = 0;
+      for (int i = 0; i < threads; i++) {
+        CryptoWorker* w = &workers[i];
+        pthread_join(w->thread_, NULL);
+        if (w->enc_micros_ > enc_micros) enc_micros = w->enc_micros_;
+        if (w->dec_micros_ > dec_micros) dec_micros = w->dec_micros_;
+        enc_cycles += w->enc_cycles_;
+        dec_cycles += w->dec_cycles_;
+        pages += w->num_pages_;
+      }
+      int64_t bytes = pages * page_size;
+      print_run("encrypt", page_size, threads, enc_micros, enc_cycles, bytes);
+      print_run("decrypt", page_size, threads, dec_micros, dec_cycles, bytes);
+
+      total->done_ += 2 * pages;
+      total->bytes_ += 2 * bytes;
+      total->micros_ += enc_micros + dec_micros;
+      free(workers);
+    }
+  }
+}
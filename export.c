@@ -0,0 +1,113 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+static const char* const kExportNames[] = {
+  "export_encrypt", "export_decrypt", "export_reencrypt"
+};
+
+/*
+ * Copy file_name into <file_name>.export with ATTACH ... KEY and
+ * sqlcipher_export(), the way databases are migrated:
+ *
+ *   kExportEncrypt    plaintext database into an encrypted one
+ *   kExportDecrypt    encrypted database into a plaintext one
+ *   kExportReencrypt  encrypted database into one with the default
+ *                     settings of FLAGS_export_compatibility
+ *
+ * One op per page of the source.  Page reads and writes are the cache
+ * misses and cache writes of the connection, which span both databases.
+ */
+void export_run(const char* file_name, int mode, ThreadStats* total) {
+  const char* name = kExportNames[mode];
+  memset(total, 0, sizeof(ThreadStats));
+  if (mode == kExportEncrypt && (FLAGS_use_sqlcipher || FLAGS_key == NULL)) {
+    fprintf(stderr, "%-12s : needs --use_sqlcipher=0 and --key;\n", name);
+    return;
+  }
+  if (mode != kExportEncrypt && !FLAGS_use_sqlcipher) {
+    fprintf(stderr, "%-12s : needs --use_sqlcipher=1;\n", name);
+    return;
+  }
+
+  char target[900], target_wal[1000], target_journal[1000];
+  snprintf(target, sizeof(target), "%s.export", file_name);
+  snprintf(target_wal, sizeof(target_wal), "%s-wal", target);
+  snprintf(target_journal, sizeof(target_journal), "%s-journal", target);
+  remove(target);
+  remove(target_wal);
+  remove(target_journal);
+
+  sqlite3* db = benchmark_open_db(file_name, 0, true);
+  int64_t page_size = query_int(db, "PRAGMA page_size");
+  int64_t page_count = query_int(db, "PRAGMA page_count");
+
+  char* key = mode == kExportDecrypt ? sqlite3_mprintf("%s", "")
+                                     : benchmark_key_string();
+  char* target_name = storage_attach_name(target);
+  char* attach_stmt = sqlite3_mprintf("ATTACH DATABASE %Q AS export KEY %Q",
+                                      target_name, key);
+  char compat_stmt[100];
+  snprintf(compat_stmt, sizeof(compat_stmt),
+           "PRAGMA export.cipher_compatibility = %d",
+           FLAGS_export_compatibility);
+
+  int cur, hi;
+  sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_MISS, &cur, &hi, 1);
+  sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_WRITE, &cur, &hi, 1);
+  int64_t heap_before = sqlite3_memory_used();
+  sqlite3_memory_highwater(1);
+  bool rss_reset = max_rss_reset();
+
+  char* err_msg = NULL;
+  int status;
+  double start = now_micros();
+  status = sqlite3_exec(db, attach_stmt, NULL, NULL, &err_msg);
+  exec_error_check(status, err_msg);
+  if (mode == kExportReencrypt) {
+    status = sqlite3_exec(db, compat_stmt, NULL, NULL, &err_msg);
+    exec_error_check(status, err_msg);
+  }
+  status = sqlite3_exec(db, "SELECT sqlcipher_export('export')", NULL, NULL,
+                        &err_msg);
+  exec_error_check(status, err_msg);
+  /* A memdb target is freed on DETACH, so take its size first */
+  int64_t target_bytes = storage_memdb() ?
+      query_int(db, "PRAGMA export.page_count") *
+      query_int(db, "PRAGMA export.page_size") : 0;
+  status = sqlite3_exec(db, "DETACH DATABASE export", NULL, NULL, &err_msg);
+  exec_error_check(status, err_msg);
+  double micros = now_micros() - start;
+
+  int64_t reads, writes;
+  sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_MISS, &cur, &hi, 0);
+  reads = cur;
+  sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_WRITE, &cur, &hi, 0);
+  writes = cur;
+  sqlite3_free(attach_stmt);
+  sqlite3_free(target_name);
+  sqlite3_free(key);
+  status = sqlite3_close(db);
+  error_check(status);
+
+  int64_t bytes = page_count * page_size;
+  if (!storage_memdb()) {
+    target_bytes = file_size(target);
+  }
+  fprintf(stderr, "%-12s : %.1f MB -> %.1f MB, %.1f MB/s, %.0f pages/s;\n",
+          name, bytes / 1048576.0, target_bytes / 1048576.0,
+          micros > 0 ? (bytes / 1048576.0) / (micros / 1e6) : 0.0,
+          micros > 0 ? page_count / (micros / 1e6) : 0.0);
+  fprintf(stderr, "%-12s : %" PRId64 " page reads, %" PRId64 " page writes, "
+          "%.1f MB SQLite heap peak (+%.1f MB), %.1f MB %smax RSS;\n",
+          name, reads, writes, sqlite3_memory_highwater(0) / 1048576.0,
+          (sqlite3_memory_highwater(0) - heap_before) / 1048576.0,
+          max_rss() / 1048576.0, rss_reset ? "" : "process ");
+
+  total->done_ = page_count;
+  total->bytes_ = bytes;
+  total->pages_ = reads + writes;
+  total->micros_ = micros;
+}
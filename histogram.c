@@ -0,0 +1,252 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+static const double kBucketLimit[kNumBuckets] = {
+  1,
+  2,
+  3,
+  4,
+  5,
+  6,
+  7,
+  8,
+  9,
+  10,
+  12,
+  14,
+  16,
+  18,
+  20,
+  25,
+  30,
+  35,
+  40,
+  45,
+  50,
+  60,
+  70,
+  80,
+  90,
+  100,
+  120,
+  140,
+  160,
+  180,
+  200,
+  250,
+  300,
+  350,
+  400,
+  450,
+  500,
+  600,
+  700,
+  800,
+  900,
+  1000,
+  1200,
+  1400,
+  1600,
+  1800,
+  2000,
+  2500,
+  3000,
+  3500,
+  4000,
+  4500,
+  5000,
+  6000,
+  7000,
+  8000,
+  9000,
+  10000,
+  12000,
+  14000,
+  16000,
+  18000,
+  20000,
+  25000,
+  30000,
+  35000,
+  40000,
+  45000,
+  50000,
+  60000,
+  70000,
+  80000,
+  90000,
+  100000,
+  120000,
+  140000,
+  160000,
+  180000,
+  200000,
+  250000,
+  300000,
+  350000,
+  400000,
+  450000,
+  500000,
+  600000,
+  700000,
+  800000,
+  900000,
+  1000000,
+  1200000,
+  1400000,
+  1600000,
+  1800000,
+  2000000,
+  2500000,
+  3000000,
+  3500000,
+  4000000,
+  4500000,
+  5000000,
+  6000000,
+  7000000,
+  8000000,
+  9000000,
+  10000000,
+  12000000,
+  14000000,
+  16000000,
+  18000000,
+  20000000,
+  25000000,
+  30000000,
+  35000000,
+  40000000,
+  45000000,
+  50000000,
+  60000000,
+  70000000,
+  80000000,
+  90000000,
+  100000000,
+  120000000,
+  140000000,
+  160000000,
+  180000000,
+  200000000,
+  250000000,
+  300000000,
+  350000000,
+  400000000,
+  450000000,
+  500000000,
+  600000000,
+  700000000,
+  800000000,
+  900000000,
+  1000000000,
+  1200000000,
+  1400000000,
+  1600000000,
+  1800000000,
+  2000000000,
+  2500000000.0,
+  3000000000.0,
+  3500000000.0,
+  4000000000.0,
+  4500000000.0,
+  5000000000.0,
+  6000000000.0,
+  7000000000.0,
+  8000000000.0,
+  9000000000.0,
+  1e200,
+};
+
+void histogram_clear(Histogram* h) {
+  h->min_ = kBucketLimit[kNumBuckets - 1];
+  h->max_ = 0;
+  h->num_ = 0;
+  h->sum_ = 0;
+  h->sum_squares_ = 0;
+  for (int i = 0; i < kNumBuckets; i++) {
+    h->buckets_[i] = 0;
+  }
+}
+
+void histogram_add(Histogram* h, double value) {
+  /* Linear search is fast enough for our usage in db_bench */
+  int b = 0;
+  while (b < kNumBuckets - 1 && kBucketLimit[b] <= value) {
+    b++;
+  }
+  h->buckets_[b] += 1.0;
+  if (h->min_ > value) h->min_ = value;
+  if (h->max_ < value) h->max_ = value;
+  h->num_++;
+  h->sum_ += value;
+  h->sum_squares_ += (value * value);
+}
+
+double histogram_median(const Histogram* h) {
+  return histogram_percentile(h, 50.0);
+}
+
+double histogram_percentile(const Histogram* h, double p) {
+  double threshold = h->num_ * (p / 100.0);
+  double sum = 0;
+  for (int b = 0; b < kNumBuckets; b++) {
+    sum += h->buckets_[b];
+    if (sum >= threshold) {
+      /* Scale linearly within this bucket */
+      double left_point = (b == 0) ? 0 : kBucketLimit[b - 1];
+      double right_point = kBucketLimit[b];
+      double left_sum = sum - h->buckets_[b];
+      double right_sum = sum;
+      double pos = (threshold - left_sum) / (right_sum - left_sum);
+      double r = left_point + (right_point - left_point) * pos;
+      if (r < h->min_) r = h->min_;
+      if (r > h->max_) r = h->max_;
+      return r;
+    }
+  }
+  return h->max_;
+}
+
+double histogram_average(const Histogram* h) {
+  if (h->num_ == 0.0) return 0;
+  return h->sum_ / h->num_;
+}
+
+double histogram_stddev(const Histogram* h) {
+  if (h->num_ == 0.0) return 0;
+  double variance = (h->sum_squares_ * h->num_ - h->sum_ * h->sum_) /
+                    (h->num_ * h->num_);
+  return sqrt(variance);
+}
+
+void histogram_print(const Histogram* h) {
+  fprintf(stderr, "Count: %.0f  Average: %.4f  StdDev: %.2f\n", h->num_,
+          histogram_average(h), histogram_stddev(h));
+  fprintf(stderr, "Min: %.4f  Median: %.4f  Max: %.4f\n",
+          (h->num_ == 0.0 ? 0.0 : h->min_), histogram_median(h), h->max_);
+  fprintf(stderr, "------------------------------------------------------\n");
+
+  const double mult = 100.0 / h->num_;
+  double sum = 0;
+  for (int b = 0; b < kNumBuckets; b++) {
+    if (h->buckets_[b] <= 0.0) continue;
+    sum += h->buckets_[b];
+    fprintf(stderr, "[ %7.0f, %7.0f ) %7.0f %7.3f%% %7.3f%% ",
+            ((b == 0) ? 0.0 : kBucketLimit[b - 1]),  /* left */
+            kBucketLimit[b],                         /* right */
+            h->buckets_[b],                          /* count */
+            mult * h->buckets_[b],                   /* percentage */
+            mult * sum);                             /* cumulative percentage */
+
+    /* Add hash marks based on percentage; 20 marks for 100%. */
+    int marks = (int)(20 * (h->buckets_[b] / h->num_) + 0.5);
+    for (int i = 0; i < marks; i++) {
+      fputc('#', stderr);
+    }
+    fputc('\n', stderr);
+  }
+}
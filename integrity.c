@@ -0,0 +1,143 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+/* The health checks, cipher_integrity_check only on encrypted databases */
+static const char* const kChecks[] = {
+  "integrity_check", "cipher_integrity_check"
+};
+
+typedef struct Checker {
+  pthread_t thread_;
+  const char* file_name_;
+  bool stop_;
+  int passes_[2];
+  ThreadStats stats_;
+} Checker;
+
+static int num_checks(void);
+static int64_t run_check(sqlite3*, int);
+static void* checker_main(void*);
+
+static int num_checks() {
+  return FLAGS_use_sqlcipher ? 2 : 1;
+}
+
+/*
+ * Run PRAGMA kChecks[c] on db and return the number of problems it
+ * reported: integrity_check returns a single "ok" row when it finds none,
+ * cipher_integrity_check returns no rows.
+ */
+static int64_t run_check(sqlite3* db, int c) {
+  char stmt_str[100];
+  sqlite3_stmt* stmt;
+  int64_t problems = 0;
+  int status;
+
+  snprintf(stmt_str, sizeof(stmt_str), "PRAGMA %s", kChecks[c]);
+  status = sqlite3_prepare_v2(db, stmt_str, -1, &stmt, NULL);
+  error_check(status);
+  while ((status = busy_step(stmt)) == SQLITE_ROW) {
+    const char* row = (const char*)sqlite3_column_text(stmt, 0);
+    if (row == NULL || strcmp(row, "ok")) {
+      problems++;
+    }
+  }
+  step_error_check(status);
+  status = sqlite3_finalize(stmt);
+  error_check(status);
+
+  return problems;
+}
+
+/*
+ * Run every check over file_name once, one op per page checked.
+ */
+void integrity_run(const char* file_name, ThreadStats* total) {
+  memset(total, 0, sizeof(ThreadStats));
+  sqlite3* db = benchmark_open_db(file_name, 0, false);
+  int64_t page_size = query_int(db, "PRAGMA page_size");
+  int64_t page_count = query_int(db, "PRAGMA page_count");
+  int64_t bytes = page_count * page_size;
+
+  db_pages(db, true);
+  for (int c = 0; c < num_checks(); c++) {
+    double start = now_micros();
+    int64_t problems = run_check(db, c);
+    double micros = now_micros() - start;
+
+    fprintf(stderr, "%-12s : %s %" PRId64 " problems, %.1f MB, %.1f MB/s, "
+            "%.0f pages/s;\n", "integrity", kChecks[c], problems,
+            bytes / 1048576.0,
+            micros > 0 ? (bytes / 1048576.0) / (micros / 1e6) : 0.0,
+            micros > 0 ? page_count / (micros / 1e6) : 0.0);
+    total->done_ += page_count;
+    total->bytes_ += bytes;
+    total->micros_ += micros;
+  }
+  total->pages_ = db_pages(db, false);
+
+  int status = sqlite3_close(db);
+  error_check(status);
+}
+
+/* Run the checks in turn until told to stop */
+static void* checker_main(void* arg) {
+  Checker* k = arg;
+  sqlite3* db = benchmark_open_db(k->file_name_, 0, false);
+  int64_t page_count = query_int(db, "PRAGMA page_count");
+  int64_t page_size = query_int(db, "PRAGMA page_size");
+
+  double start = now_micros();
+  for (int c = 0; !__atomic_load_n(&k->stop_, __ATOMIC_RELAXED);
+       c = (c + 1) % num_checks()) {
+    run_check(db, c);
+    k->passes_[c]++;
+    k->stats_.done_ += page_count;
+    k->stats_.bytes_ += page_count * page_size;
+  }
+  k->stats_.micros_ = now_micros() - start;
+
+  int status = sqlite3_close(db);
+  error_check(status);
+  return NULL;
+}
+
+/*
+ * Look up num_reads random keys in file_name from one reader, the way
+ * readrandom does, first alone and then while another connection runs
+ * the checks back to back, and report how much the checks slow the
+ * reads.  The ops are the reads made alongside the checks.
+ */
+void integrity_read(const char* file_name, int num_keys, int num_reads,
+                    ThreadStats* total) {
+  Readers readers;
+  ThreadStats alone;
+  readers_start(&readers, file_name, 1, num_keys, num_reads);
+  readers_join(&readers, &alone);
+
+  Checker checker;
+  memset(&checker, 0, sizeof(checker));
+  checker.file_name_ = file_name;
+  thread_create(&checker.thread_, 2, checker_main, &checker);
+  readers_start(&readers, file_name, 1, num_keys, num_reads);
+  readers_join(&readers, total);
+  __atomic_store_n(&checker.stop_, true, __ATOMIC_RELAXED);
+  pthread_join(checker.thread_, NULL);
+
+  double alone_rate = alone.micros_ > 0 ? alone.done_ / (alone.micros_ / 1e6)
+                                        : 0.0;
+  double rate = total->micros_ > 0 ? total->done_ / (total->micros_ / 1e6)
+                                   : 0.0;
+  fprintf(stderr, "%-12s : readrandom alone %.0f ops/sec, with checks "
+          "%.0f ops/sec (%.2fx);\n", "integrityread", alone_rate, rate,
+          alone_rate > 0 ? rate / alone_rate : 0.0);
+  fprintf(stderr, "%-12s : %d integrity_check, %d cipher_integrity_check "
+          "passes, %.1f MB/s;\n", "integrityread", checker.passes_[0],
+          checker.passes_[1],
+          checker.stats_.micros_ > 0 ?
+              (checker.stats_.bytes_ / 1048576.0) /
+              (checker.stats_.micros_ / 1e6) : 0.0);
+}
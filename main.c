@@ -22,6 +22,32 @@
 //   readrand100K  -- read N/1000 100K values in random order in async mode
 //   delete        -- delete N row in sequential key order in async mode
 //   deletesync    -- delete N row in sequential key order in sync mode
+//   fillcontend   -- write N values in random key order from FLAGS_threads
+//                    connections to the same database
+//   poolprivate   -- read N times in random order from FLAGS_threads workers
+//                    sharing FLAGS_pool_size private-cache connections
+//   poolshared    -- same as poolprivate with a shared cache and
+//                    read_uncommitted
+//   threadmodes   -- read N times in random order in every threading mode,
+//                    from one thread and from FLAGS_threads threads
+//   openkey       -- open, key, query and close a connection FLAGS_opens
+//                    times
+//   rekey         -- rotate the key of the database with PRAGMA rekey and
+//                    back, one op per page
+//   export_encrypt   -- sqlcipher_export() the plaintext database into an
+//                       encrypted copy, one op per page
+//   export_decrypt   -- sqlcipher_export() the encrypted database into a
+//                       plaintext copy
+//   export_reencrypt -- sqlcipher_export() the encrypted database into a copy
+//                       with FLAGS_export_compatibility settings
+//   cryptobench   -- encrypt and decrypt pages of 1K to 64K with AES-256-CBC
+//                    and HMAC-SHA512 alone, from 1 and FLAGS_threads threads
+//   integrity     -- PRAGMA integrity_check and cipher_integrity_check, one
+//                    op per page
+//   integrityread -- read N times in random order, alone and while the
+//                    integrity checks run on another connection
+//   attach        -- attach FLAGS_attach databases with their own keys and
+//                    settings, then look up, join and commit across them
 char* FLAGS_benchmarks;
 
 // Number of key/values to place in database
@@ -44,6 +70,11 @@ int FLAGS_page_size;
 // Default cache size = FLAGS_page_size * FLAGS_num_pages = 4 MB.
 int FLAGS_num_pages;
 
+// Bytes of the database file each connection memory-maps with PRAGMA
+// mmap_size, -1 leaves the SQLite default.  Page faults and RSS are
+// reported after each benchmark when set.
+int64_t FLAGS_mmap_size;
+
 // If true, do not destroy the existing database.  If you set this
 // flag and also specify a benchmark that wants a fresh database, that
 // benchmark will fail.
@@ -64,6 +95,166 @@ bool FLAGS_use_sqlcipher;
 // Use the key to access to sqlcipher
 char* FLAGS_key;
 
+// How FLAGS_key is handed to sqlcipher: "passphrase" runs it through the
+// KDF, "raw" uses it as a 32-byte key given as 64 hex digits, and
+// "raw_with_salt" adds FLAGS_key_salt to the raw key.
+char* FLAGS_key_mode;
+
+// Database salt as 32 hex digits, used with --key_mode=raw_with_salt
+char* FLAGS_key_salt;
+
+// Number of generator threads feeding the writer.  If 0, keys and values
+// are generated up front by the writer itself.
+int FLAGS_pipeline_threads;
+
+// Number of batches the generator/writer queue can hold
+int FLAGS_pipeline_depth;
+
+// Number of database files dbbench_sqlite3.<i>.db the keys are spread
+// over, each written and read by its own thread.  1 disables sharding.
+int FLAGS_shards;
+
+// How keys are routed to shards: "hash" or "range"
+char* FLAGS_shard_routing;
+
+// Number of threads, each with its own connection, used by the
+// multi-threaded benchmarks
+int FLAGS_threads;
+
+// What a connection does when it finds the database locked: "none" fails
+// at once, "timeout" waits like sqlite3_busy_timeout(), "backoff" waits
+// with exponential backoff and "retry" retries immediately.
+char* FLAGS_busy_strategy;
+
+// Milliseconds a connection waits for a lock before giving up
+int FLAGS_busy_timeout;
+
+// Number of connections in the pool used by the pool benchmarks
+int FLAGS_pool_size;
+
+// Number of connections the openkey benchmark opens
+int FLAGS_opens;
+
+// SQLCipher major version whose default settings export_reencrypt
+// writes the copy with
+int FLAGS_export_compatibility;
+
+// Number of encrypted databases the attach benchmark attaches
+int FLAGS_attach;
+
+// SQLite threading mode set with sqlite3_config() before
+// sqlite3_initialize(): "single", "multi" or "serialized".  NULL keeps the
+// mode the library was compiled with.
+char* FLAGS_threading_mode;
+
+// CPUs benchmark threads are pinned to: "compact" fills one NUMA node
+// before the next, "scatter" deals threads round-robin over the nodes,
+// or an explicit list such as "0,2,4-7".  NULL leaves threads unpinned.
+char* FLAGS_cpu_affinity;
+
+// NUMA memory policy: "local" or "interleave".  NULL leaves the policy the
+// process was started with.
+char* FLAGS_numa_policy;
+
+// SQLCipher page size in bytes.  0 keeps the library default.
+int FLAGS_cipher_page_size;
+
+// PBKDF2 iterations used to derive the key.  0 keeps the library default.
+int FLAGS_kdf_iter;
+
+// HMAC algorithm: "HMAC_SHA1", "HMAC_SHA256" or "HMAC_SHA512".  NULL keeps
+// the library default.  "off" sets FLAGS_cipher_use_hmac to 0 instead.
+char* FLAGS_cipher_hmac_algorithm;
+
+// KDF algorithm: "PBKDF2_HMAC_SHA1", "PBKDF2_HMAC_SHA256" or
+// "PBKDF2_HMAC_SHA512".  NULL keeps the library default.
+char* FLAGS_cipher_kdf_algorithm;
+
+// If 0, pages carry no HMAC.  -1 keeps the library default.
+int FLAGS_cipher_use_hmac;
+
+// Use the default settings of SQLCipher major version 1 to 4.  0 keeps the
+// library default.  Applied before the other cipher flags.
+int FLAGS_cipher_compatibility;
+
+// Bytes at the start of page 1 left unencrypted, so that the header is
+// readable without the key.  -1 keeps the library default (0).
+int FLAGS_cipher_plaintext_header_size;
+
+// Salt of 32 hex digits used when the header is plaintext and so cannot
+// hold it.  NULL uses a fixed salt.
+char* FLAGS_cipher_salt;
+
+// If 1, SQLCipher wipes and mlock()s the memory it allocates, if 0 it
+// does not.  -1 keeps the library default.  Process-wide, set once
+// before any connection is opened.
+int FLAGS_cipher_memory_security;
+
+// If true, count and time the reads, writes, syncs, truncates, locks and
+// shm operations of every connection through a pass-through VFS, per
+// file kind, and report them after each benchmark.
+bool FLAGS_vfs_stats;
+
+// Delay in microseconds added to every read, write or sync: "200",
+// "100-300" for uniform jitter, or "exp200" for an exponential with that
+// mean.  NULL adds none.
+char* FLAGS_vfs_read_latency;
+char* FLAGS_vfs_write_latency;
+char* FLAGS_vfs_sync_latency;
+
+// Bandwidth in MB/s that reads and writes share, as on one device.  0 is
+// unlimited.
+double FLAGS_vfs_bandwidth;
+
+// If 1, read and write the main database and the WAL with O_DIRECT, so
+// only SQLite caches their pages.  0 or 1 also reports the memory the
+// database takes in the process and the kernel page cache; -1 neither.
+int FLAGS_vfs_direct;
+
+// If true, write and sync the main database and the WAL through io_uring:
+// the writes of a transaction are queued and submitted with a linked
+// fsync in one system call when SQLite syncs.
+bool FLAGS_vfs_uring;
+
+// Where the database files live: "file" in --db, "tmpfs" in /dev/shm,
+// or "memdb" in process memory through the memdb VFS, still encrypted
+// page by page but with no file I/O at all.
+char* FLAGS_storage;
+
+// Run every benchmark once per combination of flag values, given as
+// "flag=v1:v2:...,flag=v1:v2:...", and compare the combinations at the
+// end.  NULL runs the benchmarks once.
+char* FLAGS_sweep;
+
+// Run every benchmark on a plaintext and on an encrypted database in
+// turn, with the same keys and values, and report the encrypted run
+// relative to the plaintext one.  Needs FLAGS_key.
+bool FLAGS_compare_plaintext;
+
+// Run every benchmark with the per-page HMAC off and with each HMAC
+// algorithm in turn, and report the cost per page read or written.
+bool FLAGS_compare_hmac;
+
+// Run every benchmark without and with memory-mapped I/O, mmap_size 0
+// and FLAGS_mmap_size (1 GB if unset), and report page faults per op.
+bool FLAGS_compare_mmap;
+
+// Run only this combination of FLAGS_sweep and report the results on
+// stdout.  Used by sweeps over per-process flags, -1 otherwise.
+int FLAGS_sweep_combo;
+
+// Directories holding the SQLCipher builds to compare, "dir1:dir2".  Runs
+// the benchmarks once per build, each in a process started with its
+// directory in front of LD_LIBRARY_PATH.  NULL uses the linked build.
+char* FLAGS_sqlcipher_libs;
+
+// Directory of the SQLCipher build this process was started with, set by
+// the sweep over FLAGS_sqlcipher_libs.
+char* FLAGS_sqlcipher_lib;
+
+// Seed of the generated keys and values.  0 seeds from the clock.
+int FLAGS_seed;
+
 void init() {
   // Comma-separated list of operations to run in the specified order
   //   Actual benchmarks:
@@ -83,6 +274,32 @@ void init() {
   //   readrand100K  -- read N/1000 100K values in random order in async mode
   //   delete        -- delete N row in sequential key order in async mode
   //   deletesync    -- delete N row in sequential key order in sync mode
+  //   fillcontend   -- write N values in random key order from FLAGS_threads
+  //                    connections to the same database
+  //   poolprivate   -- read N times in random order from FLAGS_threads workers
+  //                    sharing FLAGS_pool_size private-cache connections
+  //   poolshared    -- same as poolprivate with a shared cache and
+  //                    read_uncommitted
+  //   threadmodes   -- read N times in random order in every threading mode,
+  //                    from one thread and from FLAGS_threads threads
+  //   openkey       -- open, key, query and close a connection FLAGS_opens
+  //                    times
+  //   rekey         -- rotate the key of the database with PRAGMA rekey and
+  //                    back, one op per page
+  //   export_encrypt   -- sqlcipher_export() the plaintext database into an
+  //                       encrypted copy, one op per page
+  //   export_decrypt   -- sqlcipher_export() the encrypted database into a
+  //                       plaintext copy
+  //   export_reencrypt -- sqlcipher_export() the encrypted database into a copy
+  //                       with FLAGS_export_compatibility settings
+  //   cryptobench   -- encrypt and decrypt pages of 1K to 64K with AES-256-CBC
+  //                    and HMAC-SHA512 alone, from 1 and FLAGS_threads threads
+  //   integrity     -- PRAGMA integrity_check and cipher_integrity_check, one
+  //                    op per page
+  //   integrityread -- read N times in random order, alone and while the
+  //                    integrity checks run on another connection
+  //   attach        -- attach FLAGS_attach databases with their own keys and
+  //                    settings, then look up, join and commit across them
   FLAGS_benchmarks =
     "fillseq,"
     "fillseqsync,"
@@ -105,12 +322,54 @@ void init() {
   FLAGS_compression_ratio = 0.5;
   FLAGS_page_size = 1024;
   FLAGS_num_pages = 4096;
+  FLAGS_mmap_size = -1;
   FLAGS_use_existing_db = false;
   FLAGS_transaction = true;
   FLAGS_WAL_enabled = true;
   FLAGS_db = NULL;
   FLAGS_use_sqlcipher = false;
   FLAGS_key = NULL;
+  FLAGS_key_mode = "passphrase";
+  FLAGS_key_salt = NULL;
+  FLAGS_pipeline_threads = 0;
+  FLAGS_pipeline_depth = 64;
+  FLAGS_shards = 1;
+  FLAGS_shard_routing = "hash";
+  FLAGS_threads = 4;
+  FLAGS_busy_strategy = "none";
+  FLAGS_busy_timeout = 1000;
+  FLAGS_pool_size = 4;
+  FLAGS_opens = 100;
+  FLAGS_export_compatibility = 4;
+  FLAGS_attach = 4;
+  FLAGS_threading_mode = NULL;
+  FLAGS_cpu_affinity = NULL;
+  FLAGS_numa_policy = NULL;
+  FLAGS_cipher_page_size = 0;
+  FLAGS_kdf_iter = 0;
+  FLAGS_cipher_hmac_algorithm = NULL;
+  FLAGS_cipher_kdf_algorithm = NULL;
+  FLAGS_cipher_use_hmac = -1;
+  FLAGS_cipher_compatibility = 0;
+  FLAGS_cipher_plaintext_header_size = -1;
+  FLAGS_cipher_salt = NULL;
+  FLAGS_cipher_memory_security = -1;
+  FLAGS_vfs_stats = false;
+  FLAGS_vfs_read_latency = NULL;
+  FLAGS_vfs_write_latency = NULL;
+  FLAGS_vfs_sync_latency = NULL;
+  FLAGS_vfs_bandwidth = 0;
+  FLAGS_vfs_direct = -1;
+  FLAGS_vfs_uring = false;
+  FLAGS_storage = "file";
+  FLAGS_sweep = NULL;
+  FLAGS_compare_plaintext = false;
+  FLAGS_compare_hmac = false;
+  FLAGS_compare_mmap = false;
+  FLAGS_sweep_combo = -1;
+  FLAGS_sqlcipher_libs = NULL;
+  FLAGS_sqlcipher_lib = NULL;
+  FLAGS_seed = 0;
 }
 
 void print_usage(const char* argv0) {
@@ -126,10 +385,51 @@ void print_usage(const char* argv0) {
   fprintf(stderr, "  --no_transaction\t\tdisable transaction\n");
   fprintf(stderr, "  --page_size=INT\t\tpage size\n");
   fprintf(stderr, "  --num_pages=INT\t\tnumber of pages\n");
+  fprintf(stderr, "  --mmap_size=INT\t\tbytes of the database memory-mapped, -1 for the default\n");
   fprintf(stderr, "  --WAL_enabled={0,1}\t\tenable WAL\n");
   fprintf(stderr, "  --use_sqlcipher={0,1}\t\tuse sqlcipher\n");
   fprintf(stderr, "  --db=PATH\t\t\tpath of the existing database to location databases are created\n");
   fprintf(stderr, "  --key=KEY\t\t\tkey of sqlcipher, must be set if use sqlcipher\n");
+  fprintf(stderr, "  --key_mode={passphrase,raw,raw_with_salt}\thow the key is given to sqlcipher, raw keys are 64 hex digits\n");
+  fprintf(stderr, "  --key_salt=HEX\t\tsalt of 32 hex digits for --key_mode=raw_with_salt\n");
+  fprintf(stderr, "  --pipeline_threads=INT\tgenerate write batches on INT threads feeding the writer\n");
+  fprintf(stderr, "  --pipeline_depth=INT\t\tnumber of batches queued between generators and writer\n");
+  fprintf(stderr, "  --shards=INT\t\t\tspread fill/read benchmarks over INT databases, one thread each\n");
+  fprintf(stderr, "  --shard_routing={hash,range}\troute keys to shards by hash or by key range\n");
+  fprintf(stderr, "  --threads=INT\t\t\tnumber of threads in multi-threaded benchmarks\n");
+  fprintf(stderr, "  --busy_strategy=[BUSY]\twhat to do when the database is locked\n");
+  fprintf(stderr, "  --busy_timeout=INT\t\tmilliseconds to wait for a lock before failing\n");
+  fprintf(stderr, "  --pool_size=INT\t\tnumber of connections in the pool benchmarks\n");
+  fprintf(stderr, "  --opens=INT\t\t\tnumber of connections the openkey benchmark opens\n");
+  fprintf(stderr, "  --export_compatibility={1,2,3,4}\tsqlcipher version export_reencrypt migrates to\n");
+  fprintf(stderr, "  --attach=INT\t\t\tnumber of databases the attach benchmark attaches\n");
+  fprintf(stderr, "  --threading_mode=[MODE]\tSQLite threading mode\n");
+  fprintf(stderr, "  --cpu_affinity={compact,scatter,LIST}\tpin threads to CPUs, LIST like 0,2,4-7\n");
+  fprintf(stderr, "  --numa_policy={local,interleave}\tNUMA memory policy\n");
+  fprintf(stderr, "  --cipher_page_size=INT\tsqlcipher page size\n");
+  fprintf(stderr, "  --kdf_iter=INT\t\t\tsqlcipher PBKDF2 iterations\n");
+  fprintf(stderr, "  --cipher_hmac_algorithm={off,HMAC_SHA1,HMAC_SHA256,HMAC_SHA512}\tsqlcipher HMAC algorithm\n");
+  fprintf(stderr, "  --cipher_kdf_algorithm={PBKDF2_HMAC_SHA1,PBKDF2_HMAC_SHA256,PBKDF2_HMAC_SHA512}\tsqlcipher KDF algorithm\n");
+  fprintf(stderr, "  --cipher_use_hmac={0,1}\tsqlcipher per-page HMAC\n");
+  fprintf(stderr, "  --cipher_compatibility={1,2,3,4}\tsqlcipher major version defaults\n");
+  fprintf(stderr, "  --cipher_memory_security={0,1}\tsqlcipher wipes and locks its memory\n");
+  fprintf(stderr, "  --vfs_stats={0,1}\t\tcount and time file operations per benchmark\n");
+  fprintf(stderr, "  --vfs_read_latency=[DELAY]\tdelay added to every read\n");
+  fprintf(stderr, "  --vfs_write_latency=[DELAY]\tdelay added to every write\n");
+  fprintf(stderr, "  --vfs_sync_latency=[DELAY]\tdelay added to every sync\n");
+  fprintf(stderr, "  --vfs_bandwidth=MB\t\tMB/s reads and writes share\n");
+  fprintf(stderr, "  --vfs_direct={0,1}\t\tO_DIRECT on the database and WAL, report the memory they take\n");
+  fprintf(stderr, "  --vfs_uring={0,1}\t\twrite and sync the database and WAL through io_uring\n");
+  fprintf(stderr, "  --storage={file,tmpfs,memdb}\twhere the database files live\n");
+  fprintf(stderr, "  --cipher_plaintext_header_size=INT\tbytes of page 1 sqlcipher leaves unencrypted\n");
+  fprintf(stderr, "  --cipher_salt=HEX\t\tsalt of 32 hex digits for a plaintext header\n");
+  fprintf(stderr, "  --sweep=FLAG=V1:V2[,...]\trun the benchmarks for every combination of flag values\n");
+  fprintf(stderr, "  --compare_plaintext\t\trun every benchmark plaintext and encrypted, report the overhead\n");
+  fprintf(stderr, "  --compare_hmac\t\trun every benchmark without HMAC and with each HMAC algorithm, report the cost per page\n");
+  fprintf(stderr, "  --compare_mmap\t\trun every benchmark without and with mmap, report page faults\n");
+  fprintf(stderr, "  --sweep_combo=INT\t\trun only combination INT of the sweep, results on stdout\n");
+  fprintf(stderr, "  --sqlcipher_libs=DIR1:DIR2\trun the benchmarks against the sqlcipher build in each directory\n");
+  fprintf(stderr, "  --seed=INT\t\t\tseed of keys and values, 0 uses the clock\n");
   fprintf(stderr, "  --help\t\t\tshow this help\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "[BENCH]\n");
@@ -148,7 +448,205 @@ void print_usage(const char* argv0) {
   fprintf(stderr, "  readrand100K\tread N/1000 100K values in random order in async mode\n");
   fprintf(stderr, "  delete\tdelete N row in random order in async mode\n");
   fprintf(stderr, "  deletesync\tdelete N row in random order in sync mode\n");
+  fprintf(stderr, "  fillcontend\twrite N values in random order from --threads connections at once\n");
+  fprintf(stderr, "  poolprivate\tread N times in random order from --threads workers over a pool of private-cache connections\n");
+  fprintf(stderr, "  poolshared\tread N times in random order from --threads workers over a pool of shared-cache connections\n");
+  fprintf(stderr, "  threadmodes\tread N times in random order in every threading mode from 1 and --threads threads\n");
+  fprintf(stderr, "  openkey\topen, key, count sqlite_master and close --opens times, with per-phase latency\n");
+  fprintf(stderr, "  rekey\t\trotate the key of the database with PRAGMA rekey and back\n");
+  fprintf(stderr, "  export_encrypt\tsqlcipher_export() the plaintext database into an encrypted copy\n");
+  fprintf(stderr, "  export_decrypt\tsqlcipher_export() the encrypted database into a plaintext copy\n");
+  fprintf(stderr, "  export_reencrypt\tsqlcipher_export() the encrypted database into a copy with --export_compatibility settings\n");
+  fprintf(stderr, "  cryptobench\tencrypt and decrypt 1K to 64K pages with the sqlcipher primitives alone, from 1 and --threads threads\n");
+  fprintf(stderr, "  integrity\tPRAGMA integrity_check and cipher_integrity_check\n");
+  fprintf(stderr, "  integrityread\tread N times in random order, alone and while the integrity checks run\n");
+  fprintf(stderr, "  attach\tattach --attach encrypted databases, look up, join and commit across them\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "[BUSY]\n");
+  fprintf(stderr, "  none\t\tfail the transaction at once\n");
+  fprintf(stderr, "  timeout\twait like sqlite3_busy_timeout()\n");
+  fprintf(stderr, "  backoff\twait with exponential backoff\n");
+  fprintf(stderr, "  retry\t\tretry immediately\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "[MODE]\n");
+  fprintf(stderr, "  single\tSQLITE_CONFIG_SINGLETHREAD, no mutexes at all\n");
+  fprintf(stderr, "  multi\t\tSQLITE_CONFIG_MULTITHREAD, connections opened with SQLITE_OPEN_NOMUTEX\n");
+  fprintf(stderr, "  serialized\tSQLITE_CONFIG_SERIALIZED, connections opened with SQLITE_OPEN_FULLMUTEX\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "[DELAY] in microseconds\n");
+  fprintf(stderr, "  200\t\talways 200\n");
+  fprintf(stderr, "  100-300\tuniform between 100 and 300\n");
+  fprintf(stderr, "  exp200\texponential with a mean of 200\n");
+
+}
+
+/*
+ * Set the flag given as "--name=value", return false if arg is not a
+ * valid flag.  Also used by sweep.c to apply each combination.
+ */
+bool parse_flag(char* arg) {
+  double d;
+  int n;
+  int64_t ll;
+  char junk;
+
+  if (starts_with(arg, "--benchmarks=")) {
+    FLAGS_benchmarks = arg + strlen("--benchmarks=");
+  } else if (sscanf(arg, "--compression_ratio=%lf%c", &d, &junk) == 1) {
+    FLAGS_compression_ratio = d;
+  } else if (sscanf(arg, "--use_existing_db=%d%c", &n, &junk) == 1 &&
+             (n == 0 || n == 1)) {
+    FLAGS_use_existing_db = n;
+  } else if (sscanf(arg, "--num=%d%c", &n, &junk) == 1) {
+    FLAGS_num = n;
+  } else if (sscanf(arg, "--reads=%d%c", &n, &junk) == 1) {
+    FLAGS_reads = n;
+  } else if (sscanf(arg, "--value_size=%d%c", &n, &junk) == 1) {
+    FLAGS_value_size = n;
+  } else if (!strcmp(arg, "--no_transaction")) {
+    FLAGS_transaction = false;
+  } else if (sscanf(arg, "--page_size=%d%c", &n, &junk) == 1) {
+    FLAGS_page_size = n;
+  } else if (sscanf(arg, "--num_pages=%d%c", &n, &junk) == 1) {
+    FLAGS_num_pages = n;
+  } else if (sscanf(arg, "--mmap_size=%" SCNd64 "%c", &ll, &junk) == 1 &&
+             ll >= -1) {
+    FLAGS_mmap_size = ll;
+  } else if (sscanf(arg, "--WAL_enabled=%d%c", &n, &junk) == 1 &&
+             (n == 0 || n == 1)) {
+    FLAGS_WAL_enabled = n;
+  } else if (sscanf(arg, "--use_sqlcipher=%d%c", &n, &junk) == 1 &&
+            (n == 0 || n == 1)) {
+      FLAGS_use_sqlcipher = n;
+  } else if (strncmp(arg, "--db=", 5) == 0) {
+      FLAGS_db = arg + 5;
+  } else if (strncmp(arg, "--key=", 6) == 0) {
+      FLAGS_key = arg + 6;
+  } else if (!strcmp(arg, "--key_mode=passphrase") ||
+             !strcmp(arg, "--key_mode=raw") ||
+             !strcmp(arg, "--key_mode=raw_with_salt")) {
+    FLAGS_key_mode = arg + strlen("--key_mode=");
+  } else if (starts_with(arg, "--key_salt=")) {
+    FLAGS_key_salt = arg + strlen("--key_salt=");
+  } else if (sscanf(arg, "--pipeline_threads=%d%c", &n, &junk) == 1 &&
+             n >= 0) {
+    FLAGS_pipeline_threads = n;
+  } else if (sscanf(arg, "--pipeline_depth=%d%c", &n, &junk) == 1 &&
+             n > 0) {
+    FLAGS_pipeline_depth = n;
+  } else if (sscanf(arg, "--shards=%d%c", &n, &junk) == 1 && n > 0) {
+    FLAGS_shards = n;
+  } else if (!strcmp(arg, "--shard_routing=hash") ||
+             !strcmp(arg, "--shard_routing=range")) {
+    FLAGS_shard_routing = arg + strlen("--shard_routing=");
+  } else if (sscanf(arg, "--threads=%d%c", &n, &junk) == 1 && n > 0) {
+    FLAGS_threads = n;
+  } else if (!strcmp(arg, "--busy_strategy=none") ||
+             !strcmp(arg, "--busy_strategy=timeout") ||
+             !strcmp(arg, "--busy_strategy=backoff") ||
+             !strcmp(arg, "--busy_strategy=retry")) {
+    FLAGS_busy_strategy = arg + strlen("--busy_strategy=");
+  } else if (sscanf(arg, "--busy_timeout=%d%c", &n, &junk) == 1 &&
+             n >= 0) {
+    FLAGS_busy_timeout = n;
+  } else if (sscanf(arg, "--pool_size=%d%c", &n, &junk) == 1 &&
+             n > 0) {
+    FLAGS_pool_size = n;
+  } else if (sscanf(arg, "--opens=%d%c", &n, &junk) == 1 && n > 0) {
+    FLAGS_opens = n;
+  } else if (sscanf(arg, "--export_compatibility=%d%c", &n, &junk) == 1 &&
+             n >= 1 && n <= 4) {
+    FLAGS_export_compatibility = n;
+  } else if (sscanf(arg, "--attach=%d%c", &n, &junk) == 1 && n > 0) {
+    FLAGS_attach = n;
+  } else if (!strcmp(arg, "--threading_mode=single") ||
+             !strcmp(arg, "--threading_mode=multi") ||
+             !strcmp(arg, "--threading_mode=serialized")) {
+    FLAGS_threading_mode = arg + strlen("--threading_mode=");
+  } else if (starts_with(arg, "--cpu_affinity=")) {
+    FLAGS_cpu_affinity = arg + strlen("--cpu_affinity=");
+  } else if (!strcmp(arg, "--numa_policy=local") ||
+             !strcmp(arg, "--numa_policy=interleave")) {
+    FLAGS_numa_policy = arg + strlen("--numa_policy=");
+  } else if (sscanf(arg, "--cipher_page_size=%d%c", &n, &junk) == 1 &&
+             n >= 512 && n <= 65536 && (n & (n - 1)) == 0) {
+    FLAGS_cipher_page_size = n;
+  } else if (sscanf(arg, "--kdf_iter=%d%c", &n, &junk) == 1 && n > 0) {
+    FLAGS_kdf_iter = n;
+  } else if (!strcmp(arg, "--cipher_hmac_algorithm=off")) {
+    FLAGS_cipher_hmac_algorithm = NULL;
+    FLAGS_cipher_use_hmac = 0;
+  } else if (!strcmp(arg, "--cipher_hmac_algorithm=HMAC_SHA1") ||
+             !strcmp(arg, "--cipher_hmac_algorithm=HMAC_SHA256") ||
+             !strcmp(arg, "--cipher_hmac_algorithm=HMAC_SHA512")) {
+    FLAGS_cipher_hmac_algorithm = arg + strlen("--cipher_hmac_algorithm=");
+    FLAGS_cipher_use_hmac = -1;
+  } else if (!strcmp(arg, "--cipher_kdf_algorithm=PBKDF2_HMAC_SHA1") ||
+             !strcmp(arg, "--cipher_kdf_algorithm=PBKDF2_HMAC_SHA256") ||
+             !strcmp(arg, "--cipher_kdf_algorithm=PBKDF2_HMAC_SHA512")) {
+    FLAGS_cipher_kdf_algorithm = arg + strlen("--cipher_kdf_algorithm=");
+  } else if (sscanf(arg, "--cipher_use_hmac=%d%c", &n, &junk) == 1 &&
+             (n == 0 || n == 1)) {
+    FLAGS_cipher_use_hmac = n;
+  } else if (sscanf(arg, "--cipher_compatibility=%d%c", &n, &junk) == 1 &&
+             n >= 1 && n <= 4) {
+    FLAGS_cipher_compatibility = n;
+  } else if (sscanf(arg, "--cipher_memory_security=%d%c", &n, &junk) == 1 &&
+             (n == 0 || n == 1)) {
+    FLAGS_cipher_memory_security = n;
+  } else if (sscanf(arg, "--vfs_stats=%d%c", &n, &junk) == 1 &&
+             (n == 0 || n == 1)) {
+    FLAGS_vfs_stats = n;
+  } else if (starts_with(arg, "--vfs_read_latency=") &&
+             vfsshim_parse_latency(arg + strlen("--vfs_read_latency="))) {
+    FLAGS_vfs_read_latency = arg + strlen("--vfs_read_latency=");
+  } else if (starts_with(arg, "--vfs_write_latency=") &&
+             vfsshim_parse_latency(arg + strlen("--vfs_write_latency="))) {
+    FLAGS_vfs_write_latency = arg + strlen("--vfs_write_latency=");
+  } else if (starts_with(arg, "--vfs_sync_latency=") &&
+             vfsshim_parse_latency(arg + strlen("--vfs_sync_latency="))) {
+    FLAGS_vfs_sync_latency = arg + strlen("--vfs_sync_latency=");
+  } else if (sscanf(arg, "--vfs_bandwidth=%lf%c", &d, &junk) == 1 &&
+             d >= 0) {
+    FLAGS_vfs_bandwidth = d;
+  } else if (sscanf(arg, "--vfs_direct=%d%c", &n, &junk) == 1 &&
+             (n == 0 || n == 1)) {
+    FLAGS_vfs_direct = n;
+  } else if (sscanf(arg, "--vfs_uring=%d%c", &n, &junk) == 1 &&
+             (n == 0 || n == 1)) {
+    FLAGS_vfs_uring = n;
+  } else if (!strcmp(arg, "--storage=file") ||
+             !strcmp(arg, "--storage=tmpfs") ||
+             !strcmp(arg, "--storage=memdb")) {
+    FLAGS_storage = arg + strlen("--storage=");
+  } else if (sscanf(arg, "--cipher_plaintext_header_size=%d%c", &n, &junk) == 1 &&
+             n >= 0 && n % 16 == 0) {
+    FLAGS_cipher_plaintext_header_size = n;
+  } else if (starts_with(arg, "--cipher_salt=") &&
+             is_hex(arg + strlen("--cipher_salt="), 32)) {
+    FLAGS_cipher_salt = arg + strlen("--cipher_salt=");
+  } else if (starts_with(arg, "--sweep=")) {
+    FLAGS_sweep = arg + strlen("--sweep=");
+  } else if (!strcmp(arg, "--compare_plaintext")) {
+    FLAGS_compare_plaintext = true;
+  } else if (!strcmp(arg, "--compare_hmac")) {
+    FLAGS_compare_hmac = true;
+  } else if (!strcmp(arg, "--compare_mmap")) {
+    FLAGS_compare_mmap = true;
+  } else if (sscanf(arg, "--sweep_combo=%d%c", &n, &junk) == 1 && n >= 0) {
+    FLAGS_sweep_combo = n;
+  } else if (starts_with(arg, "--sqlcipher_libs=")) {
+    FLAGS_sqlcipher_libs = arg + strlen("--sqlcipher_libs=");
+  } else if (starts_with(arg, "--sqlcipher_lib=") &&
+             is_dir(arg + strlen("--sqlcipher_lib="))) {
+    FLAGS_sqlcipher_lib = arg + strlen("--sqlcipher_lib=");
+  } else if (sscanf(arg, "--seed=%d%c", &n, &junk) == 1 && n >= 0) {
+    FLAGS_seed = n;
+  } else {
+    return false;
+  }
 
+  return true;
 }
 
 int main(int argc, char** argv) {
@@ -158,42 +656,10 @@ int main(int argc, char** argv) {
   strcpy(default_db_path, "./");
 
   for (int i = 1; i < argc; i++) {
-    double d;
-    int n;
-    char junk;
-    if (starts_with(argv[i], "--benchmarks=")) {
-      FLAGS_benchmarks = argv[i] + strlen("--benchmarks=");
-    } else if (sscanf(argv[i], "--compression_ratio=%lf%c", &d, &junk) == 1) {
-      FLAGS_compression_ratio = d;
-    } else if (sscanf(argv[i], "--use_existing_db=%d%c", &n, &junk) == 1 &&
-               (n == 0 || n == 1)) {
-      FLAGS_use_existing_db = n;
-    } else if (sscanf(argv[i], "--num=%d%c", &n, &junk) == 1) {
-      FLAGS_num = n;
-    } else if (sscanf(argv[i], "--reads=%d%c", &n, &junk) == 1) {
-      FLAGS_reads = n;
-    } else if (sscanf(argv[i], "--value_size=%d%c", &n, &junk) == 1) {
-      FLAGS_value_size = n;
-    } else if (!strcmp(argv[i], "--no_transaction")) {
-      FLAGS_transaction = false;
-    } else if (sscanf(argv[i], "--page_size=%d%c", &n, &junk) == 1) {
-      FLAGS_page_size = n;
-    } else if (sscanf(argv[i], "--num_pages=%d%c", &n, &junk) == 1) {
-      FLAGS_num_pages = n;
-    } else if (sscanf(argv[i], "--WAL_enabled=%d%c", &n, &junk) == 1 &&
-               (n == 0 || n == 1)) {
-      FLAGS_WAL_enabled = n;
-    } else if (sscanf(argv[i], "--use_sqlcipher=%d%c", &n, &junk) == 1 &&
-              (n == 0 || n == 1)) {
-        FLAGS_use_sqlcipher = n;
-    } else if (strncmp(argv[i], "--db=", 5) == 0) {
-        FLAGS_db = argv[i] + 5;
-    } else if (strncmp(argv[i], "--key=", 6) == 0) {
-        FLAGS_key = argv[i] + 6;
-    } else if (!strcmp(argv[i], "--help")) {
+    if (!strcmp(argv[i], "--help")) {
       print_usage(argv[0]);
       exit(0);
-    } else {
+    } else if (!parse_flag(argv[i])) {
       fprintf(stderr, "Invalid flag '%s'\n", argv[i]);
       exit(1);
     }
@@ -203,9 +669,14 @@ int main(int argc, char** argv) {
   if (FLAGS_db == NULL)
       FLAGS_db = default_db_path;
 
+  sweep_init(argc, argv);
+  storage_init();
+  affinity_init();
+  threading_init();
   benchmark_init();
   benchmark_run();
   benchmark_fini();
+  storage_fini();
 
   return 0;
 }
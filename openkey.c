@@ -0,0 +1,97 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+/* Phases of one connection, timed separately */
+enum OpenPhase {
+  kPhaseOpen,
+  kPhaseKey,
+  kPhaseFirstPage,
+  kPhaseSchema,
+  kPhaseClose,
+  kNumPhases
+};
+
+static const char* const kPhaseNames[kNumPhases] = {
+  "open", "key", "kdf+page1", "schema", "close"
+};
+
+/*
+ * Open file_name num_opens times the way a connection-per-request service
+ * would: sqlite3_open_v2(), key, first query, close.  With SQLCipher the
+ * key is only derived when the first page is read, which PRAGMA
+ * user_version does without loading the schema; the count over
+ * sqlite_master then parses the schema.  Prints a histogram of the whole
+ * sequence and the average, median and 99th percentile of each phase.
+ */
+void openkey_run(const char* file_name, int num_opens, ThreadStats* total) {
+  Histogram phases[kNumPhases];
+  Histogram all;
+  int status;
+
+  histogram_clear(&all);
+  for (int p = 0; p < kNumPhases; p++) {
+    histogram_clear(&phases[p]);
+  }
+
+  memset(total, 0, sizeof(ThreadStats));
+  for (int i = 0; i < num_opens; i++) {
+    sqlite3* db;
+    sqlite3_stmt* stmt;
+    double t[kNumPhases + 1];
+
+    t[kPhaseOpen] = now_micros();
+    status = storage_open(file_name, &db, SQLITE_OPEN_READWRITE |
+                          threading_open_flags());
+    if (status) {
+      fprintf(stderr, "open error: %s\n", sqlite3_errmsg(db));
+      exit(1);
+    }
+
+    t[kPhaseKey] = now_micros();
+    if (FLAGS_use_sqlcipher) {
+      benchmark_key(db);
+    }
+
+    t[kPhaseFirstPage] = now_micros();
+    status = sqlite3_prepare_v2(db, "PRAGMA user_version", -1, &stmt, NULL);
+    error_check(status);
+    while ((status = busy_step(stmt)) == SQLITE_ROW) {}
+    step_error_check(status);
+    status = sqlite3_finalize(stmt);
+    error_check(status);
+
+    t[kPhaseSchema] = now_micros();
+    status = sqlite3_prepare_v2(db, "SELECT count(*) FROM sqlite_master", -1,
+                                &stmt, NULL);
+    error_check(status);
+    while ((status = busy_step(stmt)) == SQLITE_ROW) {}
+    step_error_check(status);
+    status = sqlite3_finalize(stmt);
+    error_check(status);
+    total->pages_ += db_pages(db, false);
+
+    t[kPhaseClose] = now_micros();
+    status = sqlite3_close(db);
+    error_check(status);
+    t[kNumPhases] = now_micros();
+
+    for (int p = 0; p < kNumPhases; p++) {
+      histogram_add(&phases[p], t[p + 1] - t[p]);
+    }
+    histogram_add(&all, t[kNumPhases] - t[kPhaseOpen]);
+    total->micros_ += t[kNumPhases] - t[kPhaseOpen];
+    total->done_++;
+  }
+
+  for (int p = 0; p < kNumPhases; p++) {
+    fprintf(stderr, "%-12s : %.3f micros avg, %.3f median, %.3f p99;\n",
+            kPhaseNames[p], histogram_average(&phases[p]),
+            histogram_median(&phases[p]),
+            histogram_percentile(&phases[p], 99.0));
+  }
+  fprintf(stderr, "Microseconds per open:\n");
+  histogram_print(&all);
+}
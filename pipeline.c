@@ -0,0 +1,223 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+/* Number of entries generated per batch, rounded to the write batches */
+#define kPipelineBatch 1000
+
+static void ring_init(Ring*, int);
+static void ring_fini(Ring*);
+static bool ring_push(Ring*, Batch*);
+static Batch* ring_pop(Ring*);
+static void* generator_main(void*);
+
+/*
+ * Bounded lock-free queue after Dmitry Vyukov's bounded MPMC queue.
+ * Producers claim a slot with a CAS on enqueue_pos_, the single consumer
+ * owns dequeue_pos_.  Each slot's sequence number tells whether it is
+ * free for the producer of lap N or filled for the consumer of lap N.
+ * http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+ */
+static void ring_init(Ring* ring, int capacity) {
+  uint64_t size = 2;
+  while (size < (uint64_t)capacity) {
+    size <<= 1;
+  }
+
+  ring->slots_ = malloc(sizeof(RingSlot) * size);
+  for (uint64_t i = 0; i < size; i++) {
+    ring->slots_[i].seq_ = i;
+    ring->slots_[i].batch_ = NULL;
+  }
+  ring->mask_ = size - 1;
+  ring->enqueue_pos_ = 0;
+  ring->dequeue_pos_ = 0;
+}
+
+static void ring_fini(Ring* ring) {
+  free(ring->slots_);
+  ring->slots_ = NULL;
+}
+
+static bool ring_push(Ring* ring, Batch* batch) {
+  RingSlot* slot;
+  uint64_t pos = __atomic_load_n(&ring->enqueue_pos_, __ATOMIC_RELAXED);
+
+  for (;;) {
+    slot = &ring->slots_[pos & ring->mask_];
+    uint64_t seq = __atomic_load_n(&slot->seq_, __ATOMIC_ACQUIRE);
+    int64_t dif = (int64_t)seq - (int64_t)pos;
+    if (dif == 0) {
+      if (__atomic_compare_exchange_n(&ring->enqueue_pos_, &pos, pos + 1,
+                                      true, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (dif < 0) {
+      /* Full */
+      return false;
+    } else {
+      pos = __atomic_load_n(&ring->enqueue_pos_, __ATOMIC_RELAXED);
+    }
+  }
+
+  slot->batch_ = batch;
+  __atomic_store_n(&slot->seq_, pos + 1, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+static Batch* ring_pop(Ring* ring) {
+  uint64_t pos = ring->dequeue_pos_;
+  RingSlot* slot = &ring->slots_[pos & ring->mask_];
+  uint64_t seq = __atomic_load_n(&slot->seq_, __ATOMIC_ACQUIRE);
+
+  if ((int64_t)seq - (int64_t)(pos + 1) < 0) {
+    /* Empty */
+    return NULL;
+  }
+
+  Batch* batch = slot->batch_;
+  ring->dequeue_pos_ = pos + 1;
+  __atomic_store_n(&slot->seq_, pos + ring->mask_ + 1, __ATOMIC_RELEASE);
+
+  return batch;
+}
+
+typedef struct Generator {
+  Pipeline* pipeline_;
+  Random rand_;
+  RandomGenerator gen_;
+  pthread_t thread_;
+} Generator;
+
+static void* generator_main(void* arg) {
+  Generator* g = arg;
+  Pipeline* p = g->pipeline_;
+
+  for (;;) {
+    int b = __atomic_fetch_add(&p->next_batch_, 1, __ATOMIC_RELAXED);
+    if (b >= p->num_batches_) {
+      break;
+    }
+
+    int first = b * p->batch_size_;
+    int num = p->num_entries_ - first;
+    if (num > p->batch_size_) num = p->batch_size_;
+
+    Batch* batch = malloc(sizeof(Batch));
+    batch->num_ = num;
+    batch->keys_ = malloc(sizeof(int) * num);
+    batch->values_ = malloc(sizeof(char) * num * p->value_size_);
+    for (int i = 0; i < num; i++) {
+      if (p->order_ == SEQUENTIAL) {
+        batch->keys_[i] = first + i;
+      } else {
+        batch->keys_[i] = rand_next(&g->rand_) % p->num_entries_;
+      }
+      rand_gen_fill(&g->gen_, batch->values_ + i * p->value_size_,
+                    p->value_size_);
+    }
+
+    /* Sequential keys reach the writer in order, so batches take turns */
+    if (p->order_ == SEQUENTIAL) {
+      while (__atomic_load_n(&p->next_push_, __ATOMIC_ACQUIRE) != b) {
+        __atomic_add_fetch(&p->turn_waits_, 1, __ATOMIC_RELAXED);
+        sched_yield();
+      }
+    }
+    while (!ring_push(&p->ring_, batch)) {
+      __atomic_add_fetch(&p->producer_stalls_, 1, __ATOMIC_RELAXED);
+      sched_yield();
+    }
+    if (p->order_ == SEQUENTIAL) {
+      __atomic_store_n(&p->next_push_, b + 1, __ATOMIC_RELEASE);
+    }
+  }
+
+  return NULL;
+}
+
+void pipeline_start(Pipeline* p, const RandomGenerator* gen, uint32_t seed,
+                    int num_threads, int depth, int order, int num_entries,
+                    int value_size, int entries_per_batch) {
+  p->order_ = order;
+  p->num_entries_ = num_entries;
+  p->value_size_ = value_size;
+  p->batch_size_ = entries_per_batch < kPipelineBatch ?
+      kPipelineBatch / entries_per_batch * entries_per_batch :
+      entries_per_batch;
+  p->num_batches_ = (num_entries + p->batch_size_ - 1) / p->batch_size_;
+  p->next_batch_ = 0;
+  p->next_push_ = 0;
+  p->consumed_ = 0;
+  p->producer_stalls_ = 0;
+  p->turn_waits_ = 0;
+  p->writer_stalls_ = 0;
+  p->writer_wait_micros_ = 0;
+  p->num_threads_ = num_threads;
+  ring_init(&p->ring_, depth);
+
+  Random rnd;
+  rand_init(&rnd, seed);
+  Generator* gens = calloc(sizeof(Generator), num_threads);
+  for (int i = 0; i < num_threads; i++) {
+    gens[i].pipeline_ = p;
+    rand_init(&gens[i].rand_, rand_next(&rnd));
+    /* Share the generator's data, but read it from a different offset */
+    gens[i].gen_ = *gen;
+    gens[i].gen_.pos_ = rand_uniform(&rnd, (int)gen->data_size_);
+    thread_create(&gens[i].thread_, i + 1, generator_main, &gens[i]);
+  }
+  p->generators_ = gens;
+}
+
+Batch* pipeline_next(Pipeline* p) {
+  if (p->consumed_ >= p->num_batches_) {
+    return NULL;
+  }
+
+  Batch* batch = ring_pop(&p->ring_);
+  if (batch == NULL) {
+    double start = now_micros();
+    do {
+      p->writer_stalls_++;
+      sched_yield();
+    } while ((batch = ring_pop(&p->ring_)) == NULL);
+    p->writer_wait_micros_ += now_micros() - start;
+  }
+  p->consumed_++;
+
+  return batch;
+}
+
+void pipeline_stop(Pipeline* p, double total_micros) {
+  Generator* gens = p->generators_;
+  for (int i = 0; i < p->num_threads_; i++) {
+    pthread_join(gens[i].thread_, NULL);
+  }
+  free(gens);
+  p->generators_ = NULL;
+  ring_fini(&p->ring_);
+
+  double busy = total_micros > 0 ?
+      100.0 * (total_micros - p->writer_wait_micros_) / total_micros : 100.0;
+  fprintf(stderr, "%-12s : %d generators, writer %.1f%% busy;\n", "pipeline",
+          p->num_threads_, busy);
+  fprintf(stderr, "%-12s : %" PRId64 " writer stalls (%.3f micros), "
+          "%" PRId64 " producer stalls;\n", "pipeline",
+          p->writer_stalls_, p->writer_wait_micros_, p->producer_stalls_);
+  if (p->order_ == SEQUENTIAL) {
+    /* Generators waiting for their batch's turn, not for ring space */
+    fprintf(stderr, "%-12s : %" PRId64 " turn waits;\n", "pipeline",
+            p->turn_waits_);
+  }
+}
+
+void batch_free(Batch* batch) {
+  free(batch->keys_);
+  free(batch->values_);
+  free(batch);
+}
@@ -0,0 +1,204 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+/* Number of lookups a worker runs per connection checkout */
+#define kPoolBatch 10
+
+typedef struct Pool {
+  sqlite3** conns_;
+  sqlite3_stmt** read_stmts_;
+  int size_;
+  /* Stack of indexes of idle connections */
+  int* idle_;
+  int num_idle_;
+  pthread_mutex_t mu_;
+  pthread_cond_t cv_;
+  int64_t waits_;
+} Pool;
+
+typedef struct PoolWorker {
+  pthread_t thread_;
+  Pool* pool_;
+  int num_keys_;
+  int num_ops_;
+  Random rand_;
+  ThreadStats stats_;
+} PoolWorker;
+
+static int pool_acquire(Pool*);
+static void pool_release(Pool*, int);
+static void* pool_worker_main(void*);
+
+static int pool_acquire(Pool* pool) {
+  pthread_mutex_lock(&pool->mu_);
+  if (pool->num_idle_ == 0) {
+    pool->waits_++;
+    while (pool->num_idle_ == 0) {
+      pthread_cond_wait(&pool->cv_, &pool->mu_);
+    }
+  }
+  int i = pool->idle_[--pool->num_idle_];
+  pthread_mutex_unlock(&pool->mu_);
+
+  return i;
+}
+
+static void pool_release(Pool* pool, int i) {
+  pthread_mutex_lock(&pool->mu_);
+  pool->idle_[pool->num_idle_++] = i;
+  pthread_cond_signal(&pool->cv_);
+  pthread_mutex_unlock(&pool->mu_);
+}
+
+static void* pool_worker_main(void* arg) {
+  PoolWorker* w = arg;
+  Pool* pool = w->pool_;
+  int status;
+
+  double start = now_micros();
+  while (w->stats_.done_ < w->num_ops_) {
+    int c = pool_acquire(pool);
+    sqlite3_stmt* read_stmt = pool->read_stmts_[c];
+
+    for (int i = 0; i < kPoolBatch && w->stats_.done_ < w->num_ops_; i++) {
+      /* Bind key value into read_stmt */
+      status = sqlite3_bind_int(read_stmt, 1,
+                                rand_next(&w->rand_) % w->num_keys_);
+      error_check(status);
+
+      /* Execute read statement */
+      while ((status = busy_step(read_stmt)) == SQLITE_ROW) {
+        w->stats_.bytes_ += sqlite3_column_bytes(read_stmt, 1) + sizeof(int);
+      }
+      step_error_check(status);
+
+      /* Reset SQLite statement for another use */
+      status = sqlite3_clear_bindings(read_stmt);
+      error_check(status);
+      status = sqlite3_reset(read_stmt);
+      error_check(status);
+
+      w->stats_.done_++;
+    }
+
+    pool_release(pool, c);
+  }
+  w->stats_.micros_ = now_micros() - start;
+
+  return NULL;
+}
+
+/*
+ * Run num_reads random lookups from FLAGS_threads workers that check out
+ * connections from a pool of FLAGS_pool_size connections to file_name.
+ * With shared_cache the connections share one page cache and read
+ * uncommitted data, otherwise each keeps (and decrypts into) its own.
+ */
+void pool_read(const char* file_name, bool shared_cache, int num_keys,
+               int num_reads, ThreadStats* total) {
+  Pool pool;
+  pool.size_ = FLAGS_pool_size;
+  pool.conns_ = calloc(sizeof(sqlite3*), pool.size_);
+  pool.read_stmts_ = calloc(sizeof(sqlite3_stmt*), pool.size_);
+  pool.idle_ = calloc(sizeof(int), pool.size_);
+  pool.num_idle_ = 0;
+  pool.waits_ = 0;
+  pthread_mutex_init(&pool.mu_, NULL);
+  pthread_cond_init(&pool.cv_, NULL);
+
+  int status;
+  for (int i = 0; i < pool.size_; i++) {
+    sqlite3* db = benchmark_open_db(file_name,
+                                    shared_cache ? SQLITE_OPEN_SHAREDCACHE
+                                                 : SQLITE_OPEN_PRIVATECACHE,
+                                    false);
+    if (shared_cache) {
+      char* err_msg = NULL;
+      status = sqlite3_exec(db, "PRAGMA read_uncommitted = 1", NULL, NULL,
+                            &err_msg);
+      exec_error_check(status, err_msg);
+    }
+    status = sqlite3_prepare_v2(db, "SELECT * FROM test WHERE key = ?", -1,
+                                &pool.read_stmts_[i], NULL);
+    error_check(status);
+
+    /* Reset the cache counters */
+    int cur, hi;
+    sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_MISS, &cur, &hi, 1);
+    sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_HIT, &cur, &hi, 1);
+
+    pool.conns_[i] = db;
+    pool.idle_[pool.num_idle_++] = i;
+  }
+
+  int num_threads = FLAGS_threads;
+  PoolWorker* workers = calloc(sizeof(PoolWorker), num_threads);
+  for (int i = 0; i < num_threads; i++) {
+    workers[i].pool_ = &pool;
+    workers[i].num_keys_ = num_keys;
+    workers[i].num_ops_ = num_reads / num_threads +
+                          (i < num_reads % num_threads);
+    rand_init(&workers[i].rand_, rand_next(&rand_));
+  }
+
+  double start = now_micros();
+  for (int i = 0; i < num_threads; i++) {
+    thread_create(&workers[i].thread_, i + 1, pool_worker_main, &workers[i]);
+  }
+  memset(total, 0, sizeof(ThreadStats));
+  for (int i = 0; i < num_threads; i++) {
+    pthread_join(workers[i].thread_, NULL);
+    total->done_ += workers[i].stats_.done_;
+    total->bytes_ += workers[i].stats_.bytes_;
+  }
+  total->micros_ = now_micros() - start;
+
+  /*
+   * CACHE_USED_SHARED splits a shared cache evenly between its connections,
+   * so the sum is the total page cache either way.  The hit and miss
+   * counters belong to the pager, which a shared cache has only one of.
+   * Every cache miss is a page read from the file and, with SQLCipher,
+   * decrypted.
+   */
+  int64_t cache_used = 0, misses = 0, hits = 0;
+  for (int i = 0; i < pool.size_; i++) {
+    int cur, hi;
+    sqlite3_db_status(pool.conns_[i], SQLITE_DBSTATUS_CACHE_USED_SHARED, &cur,
+                      &hi, 0);
+    cache_used += cur;
+    if (!shared_cache || i == 0) {
+      sqlite3_db_status(pool.conns_[i], SQLITE_DBSTATUS_CACHE_MISS, &cur, &hi,
+                        0);
+      misses += cur;
+      sqlite3_db_status(pool.conns_[i], SQLITE_DBSTATUS_CACHE_HIT, &cur, &hi,
+                        0);
+      hits += cur;
+    }
+  }
+  total->pages_ = misses;
+  for (int i = 0; i < pool.size_; i++) {
+    status = sqlite3_finalize(pool.read_stmts_[i]);
+    error_check(status);
+    status = sqlite3_close(pool.conns_[i]);
+    error_check(status);
+  }
+
+  fprintf(stderr, "%-12s : %d workers, %d %s-cache connections, "
+          "%" PRId64 " checkout waits, %.1f MB/s;\n", "pool", num_threads,
+          pool.size_, shared_cache ? "shared" : "private", pool.waits_,
+          total->micros_ > 0 ?
+              (total->bytes_ / 1048576.0) / (total->micros_ / 1e6) : 0.0);
+  fprintf(stderr, "%-12s : %.1f KB page cache, %" PRId64 " decrypts "
+          "(cache misses), %" PRId64 " cache hits;\n", "pool",
+          cache_used / 1024.0, misses, hits);
+
+  free(workers);
+  pthread_mutex_destroy(&pool.mu_);
+  pthread_cond_destroy(&pool.cv_);
+  free(pool.conns_);
+  free(pool.read_stmts_);
+  free(pool.idle_);
+}
@@ -66,7 +66,8 @@ uint32_t rand_next(Random* rand_) {
 
 uint32_t rand_uniform(Random* rand_, int n) { return rand_next(rand_) % n; }
 
-void rand_gen_init(RandomGenerator* gen_, double compression_ratio) {
+void rand_gen_init(RandomGenerator* gen_, double compression_ratio,
+                   uint32_t seed) {
   Random rnd;
   char* piece = "";
   
@@ -75,7 +76,7 @@ void rand_gen_init(RandomGenerator* gen_, double compression_ratio) {
   gen_->pos_ = 0;
   (gen_->data_)[0] = '\0';
 
-  rand_init(&rnd, time(0));
+  rand_init(&rnd, seed);
   while (gen_->data_size_ < 1048576) {
     piece = compressible_string(&rnd, compression_ratio, 100);
     strcat(gen_->data_, piece);
@@ -96,3 +97,15 @@ char* rand_gen_generate(RandomGenerator* gen_, int len) {
 
   return substr;
 }
+
+/*
+ * Copy the next len bytes of generated data into dst without allocating.
+ */
+void rand_gen_fill(RandomGenerator* gen_, char* dst, int len) {
+  if (gen_->pos_ + len > gen_->data_size_) {
+    gen_->pos_ = 0;
+    assert(len < gen_->data_size_);
+  }
+  memcpy(dst, (gen_->data_) + gen_->pos_, len);
+  gen_->pos_ += len;
+}
@@ -0,0 +1,101 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+typedef struct Reader {
+  pthread_t thread_;
+  const char* file_name_;
+  int num_keys_;
+  int num_ops_;
+  Random rand_;
+  ThreadStats stats_;
+} Reader;
+
+static void* reader_main(void*);
+
+static void* reader_main(void* arg) {
+  Reader* r = arg;
+  sqlite3* db = benchmark_open_db(r->file_name_, 0, false);
+  int status;
+
+  sqlite3_stmt* read_stmt;
+  char *read_str = "SELECT * FROM test WHERE key = ?";
+  status = sqlite3_prepare_v2(db, read_str, -1, &read_stmt, NULL);
+  error_check(status);
+
+  db_pages(db, true);
+  double start = now_micros();
+  while (r->stats_.done_ < r->num_ops_) {
+    /* Bind key value into read_stmt */
+    status = sqlite3_bind_int(read_stmt, 1,
+                              rand_next(&r->rand_) % r->num_keys_);
+    error_check(status);
+
+    /* Execute read statement */
+    while ((status = busy_step(read_stmt)) == SQLITE_ROW) {
+      r->stats_.bytes_ += sqlite3_column_bytes(read_stmt, 1) + sizeof(int);
+    }
+    step_error_check(status);
+
+    /* Reset SQLite statement for another use */
+    status = sqlite3_clear_bindings(read_stmt);
+    error_check(status);
+    status = sqlite3_reset(read_stmt);
+    error_check(status);
+
+    r->stats_.done_++;
+  }
+  r->stats_.micros_ = now_micros() - start;
+  r->stats_.pages_ = db_pages(db, false);
+
+  status = sqlite3_finalize(read_stmt);
+  error_check(status);
+  status = sqlite3_close(db);
+  error_check(status);
+
+  return NULL;
+}
+
+/*
+ * Start num_threads threads that each open their own connection to
+ * file_name and look up random keys, num_reads in total.
+ */
+void readers_start(Readers* readers, const char* file_name, int num_threads,
+                   int num_keys, int num_reads) {
+  Reader* r = calloc(sizeof(Reader), num_threads);
+
+  for (int i = 0; i < num_threads; i++) {
+    r[i].file_name_ = file_name;
+    r[i].num_keys_ = num_keys;
+    r[i].num_ops_ = num_reads / num_threads + (i < num_reads % num_threads);
+    rand_init(&r[i].rand_, rand_next(&rand_));
+  }
+
+  readers->readers_ = r;
+  readers->num_threads_ = num_threads;
+  readers->start_ = now_micros();
+  for (int i = 0; i < num_threads; i++) {
+    thread_create(&r[i].thread_, i + 1, reader_main, &r[i]);
+  }
+}
+
+/*
+ * Wait for the readers.  total receives the summed counters and the wall
+ * time since readers_start().
+ */
+void readers_join(Readers* readers, ThreadStats* total) {
+  memset(total, 0, sizeof(ThreadStats));
+  for (int i = 0; i < readers->num_threads_; i++) {
+    Reader* r = &readers->readers_[i];
+    pthread_join(r->thread_, NULL);
+    total->done_ += r->stats_.done_;
+    total->bytes_ += r->stats_.bytes_;
+    total->pages_ += r->stats_.pages_;
+  }
+  total->micros_ = now_micros() - readers->start_;
+
+  free(readers->readers_);
+  readers->readers_ = NULL;
+}
@@ -0,0 +1,95 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+/*
+ * Rotate the key of file_name with PRAGMA rekey, which decrypts and
+ * re-encrypts every page, and then rotate it back so the following
+ * benchmarks can still open it; if that fails the run stops.  Each
+ * rotation counts one op per page.
+ * The WAL and journal sizes are taken before the final checkpoint, so they
+ * show how much a rotation grows them.
+ *
+ * PRAGMA rekey keeps the cipher settings; moving to other settings takes
+ * sqlcipher_export(), see the export_reencrypt benchmark.
+ */
+void rekey_run(const char* file_name, ThreadStats* total) {
+  memset(total, 0, sizeof(ThreadStats));
+  if (!FLAGS_use_sqlcipher) {
+    fprintf(stderr, "%-12s : needs --use_sqlcipher=1;\n", "rekey");
+    return;
+  }
+
+  sqlite3* db = benchmark_open_db(file_name, 0, true);
+  int64_t page_size = query_int(db, "PRAGMA page_size");
+  int64_t page_count = query_int(db, "PRAGMA page_count");
+
+  char wal_name[1000], journal_name[1000];
+  snprintf(wal_name, sizeof(wal_name), "%s-wal", file_name);
+  snprintf(journal_name, sizeof(journal_name), "%s-journal", file_name);
+  int64_t wal_before = file_size(wal_name);
+  int64_t journal_before = file_size(journal_name);
+  int64_t wal_peak = wal_before, journal_peak = journal_before;
+
+  int64_t heap_before = sqlite3_memory_used();
+  sqlite3_memory_highwater(1);
+  bool rss_reset = max_rss_reset();
+  db_pages(db, true);
+
+  char* keys[2];
+  keys[0] = sqlite3_mprintf("%s-rekeyed", FLAGS_key);
+  keys[1] = benchmark_key_string();
+  for (int pass = 0; pass < 2; pass++) {
+    char* rekey_stmt = sqlite3_mprintf("PRAGMA rekey = %Q", keys[pass]);
+    char* err_msg = NULL;
+
+    double start = now_micros();
+    int status = sqlite3_exec(db, rekey_stmt, NULL, NULL, &err_msg);
+    double micros = now_micros() - start;
+    sqlite3_free(rekey_stmt);
+    if (status != SQLITE_OK) {
+      fprintf(stderr, "%-12s : failed under journal_mode=%s: %s;\n", "rekey",
+              FLAGS_WAL_enabled ? "WAL" : "DELETE", err_msg);
+      sqlite3_free(err_msg);
+      if (pass == 1) {
+        /* The following benchmarks would fail to open it with SQLITE_NOTADB */
+        fprintf(stderr, "%s is left under key '%s' instead of --key\n",
+                file_name, keys[0]);
+        exit(1);
+      }
+      break;
+    }
+
+    if (file_size(wal_name) > wal_peak) wal_peak = file_size(wal_name);
+    if (file_size(journal_name) > journal_peak) {
+      journal_peak = file_size(journal_name);
+    }
+    fprintf(stderr, "%-12s : %s, %" PRId64 " pages of %" PRId64 " bytes, "
+            "%.1f MB/s, %.0f pages/s;\n", "rekey",
+            pass == 0 ? "rotate" : "restore", page_count, page_size,
+            micros > 0 ? (page_count * page_size / 1048576.0) / (micros / 1e6)
+                       : 0.0,
+            micros > 0 ? page_count / (micros / 1e6) : 0.0);
+    total->done_ += page_count;
+    total->bytes_ += page_count * page_size;
+    total->micros_ += micros;
+  }
+  total->pages_ = db_pages(db, false);
+  sqlite3_free(keys[0]);
+  sqlite3_free(keys[1]);
+
+  fprintf(stderr, "%-12s : %.1f MB SQLite heap peak (+%.1f MB), "
+          "%.1f MB %smax RSS;\n", "rekey",
+          sqlite3_memory_highwater(0) / 1048576.0,
+          (sqlite3_memory_highwater(0) - heap_before) / 1048576.0,
+          max_rss() / 1048576.0, rss_reset ? "" : "process ");
+  fprintf(stderr, "%-12s : wal %.1f -> %.1f MB, journal %.1f -> %.1f MB;\n",
+          "rekey", wal_before / 1048576.0, wal_peak / 1048576.0,
+          journal_before / 1048576.0, journal_peak / 1048576.0);
+
+  wal_checkpoint(db);
+  int status = sqlite3_close(db);
+  error_check(status);
+}
@@ -0,0 +1,388 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+typedef struct Shard {
+  int id_;
+  sqlite3* db_;
+  pthread_t thread_;
+  Random rand_;
+  RandomGenerator gen_;
+  /* Keys [lo_, hi_) are scanned for keys owned by this shard */
+  int lo_;
+  int hi_;
+  int num_ops_;
+  ThreadStats stats_;
+} Shard;
+
+/* Parameters of the benchmark currently running on every shard */
+typedef struct ShardJob {
+  bool write_sync_;
+  int order_;
+  int num_keys_;
+  int value_size_;
+} ShardJob;
+
+static Shard* shards_;
+static int num_shards_;
+static bool by_range_;
+static ShardJob job_;
+
+static uint32_t shard_hash(uint32_t);
+static bool shard_owns(const Shard*, int);
+static int shard_next_key(Shard*, int*);
+static void shard_prepare(int, int);
+static void shard_spawn(void* (*)(void*), const char*, ThreadStats*);
+static void* shard_write_main(void*);
+static void* shard_read_main(void*);
+
+/*
+ * Finalization step of MurmurHash3, spreads sequential keys over shards.
+ */
+static uint32_t shard_hash(uint32_t h) {
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+
+  return h;
+}
+
+static bool shard_owns(const Shard* s, int key) {
+  if (by_range_) {
+    return true;
+  }
+
+  return shard_hash((uint32_t)key) % num_shards_ == (uint32_t)s->id_;
+}
+
+/*
+ * Return the next key routed to shard s.  Sequential order scans the
+ * shard's key range from *cursor and returns -1 once it is exhausted.
+ */
+static int shard_next_key(Shard* s, int* cursor) {
+  if (job_.order_ == SEQUENTIAL) {
+    while (*cursor < s->hi_) {
+      int key = (*cursor)++;
+      if (shard_owns(s, key)) {
+        return key;
+      }
+    }
+    return -1;
+  }
+
+  for (;;) {
+    int key = s->lo_ + rand_uniform(&s->rand_, s->hi_ - s->lo_);
+    if (shard_owns(s, key)) {
+      return key;
+    }
+  }
+}
+
+void shard_open() {
+  num_shards_ = FLAGS_shards;
+  by_range_ = !strcmp(FLAGS_shard_routing, "range");
+  shards_ = calloc(sizeof(Shard), num_shards_);
+
+  for (int i = 0; i < num_shards_; i++) {
+    char file_name[100];
+    char suffix[20];
+    sweep_file_suffix(suffix, sizeof(suffix));
+    snprintf(file_name, sizeof(file_name), "%sdbbench_sqlite3%s.%d.db",
+             FLAGS_db, suffix, i);
+    shards_[i].id_ = i;
+    shards_[i].db_ = benchmark_open_db(file_name, 0, true);
+  }
+}
+
+void shard_close() {
+  for (int i = 0; i < num_shards_; i++) {
+    int status = sqlite3_close(shards_[i].db_);
+    error_check(status);
+  }
+  free(shards_);
+  shards_ = NULL;
+  num_shards_ = 0;
+}
+
+void shard_exec(const char* sql) {
+  for (int i = 0; i < num_shards_; i++) {
+    char* err_msg = NULL;
+    int status = sqlite3_exec(shards_[i].db_, sql, NULL, NULL, &err_msg);
+    exec_error_check(status, err_msg);
+  }
+}
+
+/*
+ * Split num_keys keys and num_ops operations between the shards.
+ */
+static void shard_prepare(int num_keys, int num_ops) {
+  int num_owners = 0;
+  for (int i = 0; i < num_shards_; i++) {
+    Shard* s = &shards_[i];
+    if (by_range_) {
+      s->lo_ = (int)((int64_t)num_keys * i / num_shards_);
+      s->hi_ = (int)((int64_t)num_keys * (i + 1) / num_shards_);
+    } else {
+      s->lo_ = 0;
+      s->hi_ = num_keys;
+    }
+
+    /* Hash routing can leave a shard without keys even when
+     * num_keys >= num_shards; such a shard must not look for any */
+    bool owns_any = false;
+    for (int key = s->lo_; key < s->hi_ && !owns_any; key++) {
+      owns_any = shard_owns(s, key);
+    }
+    if (!owns_any) {
+      s->hi_ = s->lo_;
+    } else {
+      num_owners++;
+    }
+  }
+
+  /* Split the operations between the shards that own keys */
+  int owner = 0;
+  for (int i = 0; i < num_shards_; i++) {
+    Shard* s = &shards_[i];
+    s->num_ops_ = 0;
+    if (s->hi_ > s->lo_) {
+      s->num_ops_ = num_ops / num_owners + (owner < num_ops % num_owners);
+      owner++;
+    }
+    rand_init(&s->rand_, rand_next(&rand_));
+    /* Share the generator's data, but read it from a different offset */
+    s->gen_ = gen_;
+    s->gen_.pos_ = rand_uniform(&s->rand_, (int)gen_.data_size_);
+    memset(&s->stats_, 0, sizeof(ThreadStats));
+  }
+}
+
+/*
+ * Run fn on one thread per shard and print the per-shard breakdown.
+ * total receives the summed counters and the wall time of the slowest shard.
+ */
+static void shard_spawn(void* (*fn)(void*), const char* what,
+                        ThreadStats* total) {
+  double start = now_micros();
+  for (int i = 0; i < num_shards_; i++) {
+    thread_create(&shards_[i].thread_, i + 1, fn, &shards_[i]);
+  }
+  for (int i = 0; i < num_shards_; i++) {
+    pthread_join(shards_[i].thread_, NULL);
+  }
+  double end = now_micros();
+
+  memset(total, 0, sizeof(ThreadStats));
+  for (int i = 0; i < num_shards_; i++) {
+    ThreadStats* st = &shards_[i].stats_;
+    char label[32];
+    snprintf(label, sizeof(label), "shard %d", i);
+    fprintf(stderr, "%-12s : %d %s, %.3f micros/op, %.1f MB/s;\n", label,
+            st->done_, what, st->micros_ / (st->done_ > 0 ? st->done_ : 1),
+            st->micros_ > 0 ? (st->bytes_ / 1048576.0) / (st->micros_ / 1e6)
+                            : 0.0);
+    total->done_ += st->done_;
+    total->bytes_ += st->bytes_;
+    total->pages_ += st->pages_;
+  }
+  total->micros_ = end - start;
+  fprintf(stderr, "%-12s : %d shards, %.1f MB/s aggregate;\n", "shards",
+          num_shards_,
+          total->micros_ > 0 ?
+              (total->bytes_ / 1048576.0) / (total->micros_ / 1e6) : 0.0);
+}
+
+static void* shard_write_main(void* arg) {
+  Shard* s = arg;
+  sqlite3* db = s->db_;
+  char* err_msg = NULL;
+  int status;
+
+  sqlite3_stmt *replace_stmt, *begin_trans_stmt, *end_trans_stmt;
+  char* replace_str = "REPLACE INTO test (key, value) VALUES (?, ?)";
+  char *begin_trans_str = "BEGIN TRANSACTION";
+  char *end_trans_str = "END TRANSACTION";
+
+  /* Check for synchronous flag in options */
+  char* sync_stmt = (job_.write_sync_) ? "PRAGMA synchronous = FULL" :
+                                         "PRAGMA synchronous = OFF";
+  status = sqlite3_exec(db, sync_stmt, NULL, NULL, &err_msg);
+  exec_error_check(status, err_msg);
+
+  /* Preparing sqlite3 statements */
+  status = sqlite3_prepare_v2(db, replace_str, -1, &replace_stmt, NULL);
+  error_check(status);
+  status = sqlite3_prepare_v2(db, begin_trans_str, -1, &begin_trans_stmt,
+                              NULL);
+  error_check(status);
+  status = sqlite3_prepare_v2(db, end_trans_str, -1, &end_trans_stmt, NULL);
+  error_check(status);
+
+  char* value = malloc(sizeof(char) * job_.value_size_);
+  int cursor = s->lo_;
+  db_pages(db, true);
+  double start = now_micros();
+
+  /* Begin write transaction */
+  if (FLAGS_transaction) {
+    status = sqlite3_step(begin_trans_stmt);
+    step_error_check(status);
+    status = sqlite3_reset(begin_trans_stmt);
+    error_check(status);
+  }
+
+  for (;;) {
+    if (job_.order_ == RANDOM && s->stats_.done_ >= s->num_ops_) {
+      break;
+    }
+    int key = shard_next_key(s, &cursor);
+    if (key < 0) {
+      break;
+    }
+    rand_gen_fill(&s->gen_, value, job_.value_size_);
+
+    /* Bind KV values into replace_stmt */
+    status = sqlite3_bind_int(replace_stmt, 1, key);
+    error_check(status);
+    status = sqlite3_bind_blob(replace_stmt, 2, value, job_.value_size_,
+                               SQLITE_STATIC);
+    error_check(status);
+
+    /* Execute replace_stmt */
+    s->stats_.bytes_ += job_.value_size_ + sizeof(int);
+    status = sqlite3_step(replace_stmt);
+    step_error_check(status);
+
+    /* Reset SQLite statement for another use */
+    status = sqlite3_clear_bindings(replace_stmt);
+    error_check(status);
+    status = sqlite3_reset(replace_stmt);
+    error_check(status);
+
+    s->stats_.done_++;
+  }
+
+  /* End write transaction */
+  if (FLAGS_transaction) {
+    status = sqlite3_step(end_trans_stmt);
+    step_error_check(status);
+    status = sqlite3_reset(end_trans_stmt);
+    error_check(status);
+  }
+
+  s->stats_.micros_ = now_micros() - start;
+  s->stats_.pages_ = db_pages(db, false);
+  wal_checkpoint(db);
+  free(value);
+
+  status = sqlite3_finalize(replace_stmt);
+  error_check(status);
+  status = sqlite3_finalize(begin_trans_stmt);
+  error_check(status);
+  status = sqlite3_finalize(end_trans_stmt);
+  error_check(status);
+
+  return NULL;
+}
+
+static void* shard_read_main(void* arg) {
+  Shard* s = arg;
+  sqlite3* db = s->db_;
+  int status;
+
+  sqlite3_stmt *read_stmt, *begin_trans_stmt, *end_trans_stmt;
+  char *read_str = "SELECT * FROM test WHERE key = ?";
+  char *begin_trans_str = "BEGIN TRANSACTION";
+  char *end_trans_str = "END TRANSACTION";
+
+  /* Preparing sqlite3 statements */
+  status = sqlite3_prepare_v2(db, begin_trans_str, -1, &begin_trans_stmt,
+                              NULL);
+  error_check(status);
+  status = sqlite3_prepare_v2(db, end_trans_str, -1, &end_trans_stmt, NULL);
+  error_check(status);
+  status = sqlite3_prepare_v2(db, read_str, -1, &read_stmt, NULL);
+  error_check(status);
+
+  int cursor = s->lo_;
+  db_pages(db, true);
+  double start = now_micros();
+
+  /* Begin read transaction */
+  if (FLAGS_transaction) {
+    status = sqlite3_step(begin_trans_stmt);
+    step_error_check(status);
+    status = sqlite3_reset(begin_trans_stmt);
+    error_check(status);
+  }
+
+  while (s->stats_.done_ < s->num_ops_) {
+    int key = shard_next_key(s, &cursor);
+    if (key < 0) {
+      /* Sequential scan wrapped around */
+      cursor = s->lo_;
+      continue;
+    }
+
+    /* Bind key value into read_stmt */
+    status = sqlite3_bind_int(read_stmt, 1, key);
+    error_check(status);
+
+    /* Execute read statement */
+    while ((status = sqlite3_step(read_stmt)) == SQLITE_ROW) {
+      s->stats_.bytes_ += sqlite3_column_bytes(read_stmt, 1) + sizeof(int);
+    }
+    step_error_check(status);
+
+    /* Reset SQLite statement for another use */
+    status = sqlite3_clear_bindings(read_stmt);
+    error_check(status);
+    status = sqlite3_reset(read_stmt);
+    error_check(status);
+
+    s->stats_.done_++;
+  }
+
+  /* End read transaction */
+  if (FLAGS_transaction) {
+    status = sqlite3_step(end_trans_stmt);
+    step_error_check(status);
+    status = sqlite3_reset(end_trans_stmt);
+    error_check(status);
+  }
+
+  s->stats_.micros_ = now_micros() - start;
+  s->stats_.pages_ = db_pages(db, false);
+
+  status = sqlite3_finalize(read_stmt);
+  error_check(status);
+  status = sqlite3_finalize(begin_trans_stmt);
+  error_check(status);
+  status = sqlite3_finalize(end_trans_stmt);
+  error_check(status);
+
+  return NULL;
+}
+
+void shard_write(bool write_sync, int order, int num_entries, int value_size,
+                 ThreadStats* total) {
+  job_.write_sync_ = write_sync;
+  job_.order_ = order;
+  job_.num_keys_ = num_entries;
+  job_.value_size_ = value_size;
+  shard_prepare(num_entries, num_entries);
+  shard_spawn(shard_write_main, "writes", total);
+}
+
+void shard_read(int order, int num_keys, int num_reads, ThreadStats* total) {
+  job_.write_sync_ = false;
+  job_.order_ = order;
+  job_.num_keys_ = num_keys;
+  job_.value_size_ = 0;
+  shard_prepare(num_keys, num_reads);
+  shard_spawn(shard_read_main, "reads", total);
+}
@@ -0,0 +1,136 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+/* Where --storage=tmpfs puts the database files */
+static const char* const kTmpfsDir = "/dev/shm/";
+
+/*
+ * A memdb database is freed when its last connection closes, so one
+ * connection per file name is held open for the life of the process and
+ * the contents outlive close_main_db() and the per-thread connections.
+ */
+typedef struct StorageAnchor {
+  char* name_;
+  sqlite3* db_;
+} StorageAnchor;
+
+static pthread_mutex_t anchors_mu_ = PTHREAD_MUTEX_INITIALIZER;
+static StorageAnchor* anchors_ = NULL;
+static int num_anchors_ = 0;
+
+static void storage_hold(const char*);
+
+void storage_init() {
+  if (!strcmp(FLAGS_storage, "file")) {
+    return;
+  }
+  if (FLAGS_use_existing_db) {
+    fprintf(stderr, "--storage=%s needs --use_existing_db=0\n",
+            FLAGS_storage);
+    exit(1);
+  }
+  if (!strcmp(FLAGS_storage, "tmpfs")) {
+    if (!is_dir(kTmpfsDir)) {
+      fprintf(stderr, "--storage=tmpfs needs %s\n", kTmpfsDir);
+      exit(1);
+    }
+    FLAGS_db = (char*)kTmpfsDir;
+    return;
+  }
+
+  /* memdb */
+  if (sqlite3_vfs_find("memdb") == NULL) {
+    fprintf(stderr, "--storage=memdb needs SQLite built without "
+            "SQLITE_OMIT_DESERIALIZE\n");
+    exit(1);
+  }
+  if (vfsshim_enabled()) {
+    fprintf(stderr, "--storage=memdb does not go through the vfs_* flags\n");
+    exit(1);
+  }
+}
+
+bool storage_memdb() {
+  return !strcmp(FLAGS_storage, "memdb");
+}
+
+/*
+ * memdb has no WAL and keeps its journal in memory.  When a sweep sets
+ * memdb against files, the file runs keep their journal in memory as
+ * well, so the journal mode is the same on both sides.
+ */
+bool storage_journal_in_memory() {
+  return storage_memdb() || sweep_has_value("storage", "memdb");
+}
+
+/*
+ * Open file_name the way sqlite3_open_v2() would, through the memdb VFS
+ * under --storage=memdb.  memdb shares a database between the connections
+ * of the process only if its name starts with '/'.
+ */
+int storage_open(const char* file_name, sqlite3** db, int open_flags) {
+  if (!storage_memdb()) {
+    return sqlite3_open_v2(file_name, db, open_flags, NULL);
+  }
+
+  char* name = sqlite3_mprintf("%s%s", file_name[0] == '/' ? "" : "/",
+                               file_name);
+  int status = sqlite3_open_v2(name, db, open_flags | SQLITE_OPEN_URI,
+                               "memdb");
+  if (status == SQLITE_OK) {
+    storage_hold(name);
+  }
+  sqlite3_free(name);
+  return status;
+}
+
+/*
+ * file_name as ATTACH DATABASE takes it, to be freed with sqlite3_free().
+ * Under --storage=memdb it is a URI naming the memdb VFS, which the
+ * connections storage_open() returns accept.
+ */
+char* storage_attach_name(const char* file_name) {
+  if (!storage_memdb()) {
+    return sqlite3_mprintf("%s", file_name);
+  }
+  return sqlite3_mprintf("file:%s%s?vfs=memdb",
+                         file_name[0] == '/' ? "" : "/", file_name);
+}
+
+static void storage_hold(const char* name) {
+  pthread_mutex_lock(&anchors_mu_);
+  for (int i = 0; i < num_anchors_; i++) {
+    if (!strcmp(anchors_[i].name_, name)) {
+      pthread_mutex_unlock(&anchors_mu_);
+      return;
+    }
+  }
+
+  StorageAnchor* anchor;
+  anchors_ = realloc(anchors_, sizeof(StorageAnchor) * (num_anchors_ + 1));
+  anchor = &anchors_[num_anchors_++];
+  anchor->name_ = sqlite3_mprintf("%s", name);
+  int status = sqlite3_open_v2(name, &anchor->db_, SQLITE_OPEN_READWRITE |
+                               SQLITE_OPEN_CREATE, "memdb");
+  error_check(status);
+  pthread_mutex_unlock(&anchors_mu_);
+}
+
+/*
+ * Close the held memdb databases, which frees their contents.  Called
+ * once at exit: an interleaved sweep closes db_ after every benchmark and
+ * the next benchmark of the same combination reads what the last wrote.
+ */
+void storage_fini() {
+  for (int i = 0; i < num_anchors_; i++) {
+    int status = sqlite3_close(anchors_[i].db_);
+    error_check(status);
+    sqlite3_free(anchors_[i].name_);
+  }
+  free(anchors_);
+  anchors_ = NULL;
+  num_anchors_ = 0;
+}
@@ -0,0 +1,468 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+/* For strdup(), strtok_r(), fork() and readlink() */
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define kMaxSweepFlags 8
+#define kMaxSweepValues 16
+#define kMaxSweepCombos 256
+#define kMaxSweepResults 4096
+
+/*
+ * Flags that take effect once per process.  Sweeping any of them runs
+ * every combination in a process of its own.
+ */
+static const char* const kProcessFlags[] = {
+  "cipher_memory_security", "threading_mode", "cpu_affinity", "numa_policy",
+  "sqlcipher_lib", "vfs_stats", "vfs_read_latency", "vfs_write_latency",
+  "vfs_sync_latency", "vfs_bandwidth", "vfs_direct", "vfs_uring"
+};
+
+/*
+ * Flags only read before the first benchmark runs, which an interleaved
+ * sweep would take the first value of.  Sweeping any of them runs every
+ * combination in a process of its own as well.
+ */
+static const char* const kStartupFlags[] = {
+  "seed", "compression_ratio", "use_existing_db", "db", "storage"
+};
+
+/* One swept flag, args_[v] is "--name=value" ready for parse_flag() */
+typedef struct SweepFlag {
+  char* name_;
+  char* values_[kMaxSweepValues];
+  char* args_[kMaxSweepValues];
+  int num_values_;
+} SweepFlag;
+
+/* The slot_'th result recorded under combination combo_ */
+typedef struct SweepResult {
+  char name_[32];
+  int combo_;
+  int slot_;
+  int done_;
+  double micros_;
+  int64_t bytes_;
+  int64_t pages_;
+  int64_t faults_;
+} SweepResult;
+
+static SweepFlag flags_[kMaxSweepFlags];
+static int num_flags_;
+static int num_combos_ = 1;
+static int combo_;
+static int num_slots_[kMaxSweepCombos];
+static SweepResult results_[kMaxSweepResults];
+static char* spec_;
+static int num_results_;
+static bool in_processes_;
+static bool report_faults_;
+static int argc_;
+static char** argv_;
+
+static void sweep_error(const char*, const char*);
+static void sweep_label(int, char*, size_t);
+static void sweep_add_result(const char*, int, int, double, int64_t,
+                             int64_t, int64_t);
+
+static void sweep_error(const char* msg, const char* arg) {
+  fprintf(stderr, "invalid sweep '%s': %s '%s'\n", spec_, msg, arg);
+  exit(1);
+}
+
+/*
+ * "flag=v1:v2,flag2=v3" into flags_.  --compare_plaintext is a sweep over
+ * use_sqlcipher=0:1, --compare_hmac one over the HMAC algorithms,
+ * --compare_mmap one over mmap_size and --sqlcipher_libs one over
+ * sqlcipher_lib, in front of any other swept flag.  Every value is
+ * checked with parse_flag() up front, and the first combination (or the
+ * one of --sweep_combo) is applied so the code that runs before
+ * benchmark_run() sees it too.  argv is kept to start the processes of a
+ * sweep over a per-process flag.
+ */
+void sweep_init(int argc, char** argv) {
+  argc_ = argc;
+  argv_ = argv;
+  if (FLAGS_compare_plaintext && FLAGS_key == NULL) {
+    fprintf(stderr, "--compare_plaintext needs --key\n");
+    exit(1);
+  }
+  if (FLAGS_sqlcipher_libs != NULL) {
+    spec_ = sqlite3_mprintf("sqlcipher_lib=%s%s%s", FLAGS_sqlcipher_libs,
+                            FLAGS_sweep != NULL ? "," : "",
+                            FLAGS_sweep != NULL ? FLAGS_sweep : "");
+  } else if (FLAGS_sweep != NULL) {
+    spec_ = FLAGS_sweep;
+  }
+  if (FLAGS_compare_mmap) {
+    spec_ = sqlite3_mprintf("mmap_size=0:%" PRId64 "%s%s",
+                            FLAGS_mmap_size > 0 ? FLAGS_mmap_size
+                                                : (int64_t)1073741824,
+                            spec_ != NULL ? "," : "",
+                            spec_ != NULL ? spec_ : "");
+  }
+  if (FLAGS_compare_hmac) {
+    if (!FLAGS_use_sqlcipher && !FLAGS_compare_plaintext) {
+      fprintf(stderr, "--compare_hmac needs --use_sqlcipher=1\n");
+      exit(1);
+    }
+    spec_ = sqlite3_mprintf("cipher_hmac_algorithm=off:HMAC_SHA1:HMAC_SHA256:"
+                            "HMAC_SHA512%s%s", spec_ != NULL ? "," : "",
+                            spec_ != NULL ? spec_ : "");
+  }
+  if (FLAGS_compare_plaintext) {
+    spec_ = sqlite3_mprintf("use_sqlcipher=0:1%s%s", spec_ != NULL ? "," : "",
+                            spec_ != NULL ? spec_ : "");
+  }
+  if (spec_ == NULL) {
+    return;
+  }
+
+  char* spec = strdup(spec_);
+  char* save_flag;
+  for (char* item = strtok_r(spec, ",", &save_flag); item != NULL;
+       item = strtok_r(NULL, ",", &save_flag)) {
+    char* eq = strchr(item, '=');
+    if (eq == NULL || eq == item) {
+      sweep_error("expected flag=v1:v2 in", item);
+    }
+    if (num_flags_ == kMaxSweepFlags) {
+      sweep_error("too many flags at", item);
+    }
+    *eq = '\0';
+    SweepFlag* f = &flags_[num_flags_++];
+    f->name_ = item;
+    if (!strcmp(f->name_, "sweep") || !strcmp(f->name_, "benchmarks") ||
+        !strcmp(f->name_, "sweep_combo") ||
+        !strcmp(f->name_, "sqlcipher_libs")) {
+      sweep_error("cannot sweep", f->name_);
+    }
+    if (!strcmp(f->name_, "mmap_size")) {
+      report_faults_ = true;
+    }
+    for (size_t i = 0; i < sizeof(kProcessFlags) / sizeof(kProcessFlags[0]);
+         i++) {
+      if (!strcmp(f->name_, kProcessFlags[i])) {
+        in_processes_ = true;
+      }
+    }
+    for (size_t i = 0; i < sizeof(kStartupFlags) / sizeof(kStartupFlags[0]);
+         i++) {
+      if (!strcmp(f->name_, kStartupFlags[i])) {
+        in_processes_ = true;
+      }
+    }
+
+    char* save_value;
+    for (char* value = strtok_r(eq + 1, ":", &save_value); value != NULL;
+         value = strtok_r(NULL, ":", &save_value)) {
+      if (f->num_values_ == kMaxSweepValues) {
+        sweep_error("too many values for", f->name_);
+      }
+      size_t len = strlen(f->name_) + strlen(value) + 4;
+      char* arg = malloc(len);
+      snprintf(arg, len, "--%s=%s", f->name_, value);
+      if (!parse_flag(arg)) {
+        sweep_error("invalid value", arg);
+      }
+      f->values_[f->num_values_] = value;
+      f->args_[f->num_values_] = arg;
+      f->num_values_++;
+    }
+    if (f->num_values_ == 0) {
+      sweep_error("no values for", f->name_);
+    }
+    num_combos_ *= f->num_values_;
+    if (num_combos_ > kMaxSweepCombos) {
+      sweep_error("more than 256 combinations at", f->name_);
+    }
+  }
+
+  if (FLAGS_sweep_combo >= num_combos_) {
+    fprintf(stderr, "--sweep_combo=%d out of %d combinations\n",
+            FLAGS_sweep_combo, num_combos_);
+    exit(1);
+  }
+
+  /* Every combination would open, and change, the same existing database */
+  for (int c = 0; c < num_combos_ && num_combos_ > 1; c++) {
+    sweep_apply(c);
+    if (FLAGS_use_existing_db) {
+      fprintf(stderr, "a sweep of more than one combination needs "
+              "--use_existing_db=0\n");
+      exit(1);
+    }
+  }
+  sweep_apply(FLAGS_sweep_combo >= 0 ? FLAGS_sweep_combo : 0);
+}
+
+int sweep_count() {
+  return num_combos_;
+}
+
+/*
+ * True if benchmark_run() should run each benchmark under every
+ * combination in turn.
+ */
+bool sweep_interleaved() {
+  return num_flags_ > 0 && !in_processes_ && FLAGS_sweep_combo < 0;
+}
+
+/*
+ * True in the process that starts one process per combination.
+ */
+bool sweep_in_processes() {
+  return num_flags_ > 0 && in_processes_ && FLAGS_sweep_combo < 0;
+}
+
+/*
+ * Run the benchmarks once per combination, each in a fresh process
+ * started with the same arguments plus --sweep_combo=<combination>.  The
+ * child reports its results on stdout, one per line.
+ */
+void sweep_run_processes() {
+  char exe[4096];
+  ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+  if (len < 0) {
+    snprintf(exe, sizeof(exe), "%s", argv_[0]);
+  } else {
+    exe[len] = '\0';
+  }
+
+  char** args = calloc(sizeof(char*), argc_ + 2);
+  for (int i = 0; i < argc_; i++) {
+    args[i] = argv_[i];
+  }
+  char combo_arg[100];
+  args[argc_] = combo_arg;
+  args[argc_ + 1] = NULL;
+
+  for (int c = 0; c < num_combos_; c++) {
+    snprintf(combo_arg, sizeof(combo_arg), "--sweep_combo=%d", c);
+    int fds[2];
+    if (pipe(fds) != 0) {
+      fprintf(stderr, "pipe error\n");
+      exit(1);
+    }
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+      fprintf(stderr, "fork error\n");
+      exit(1);
+    }
+    if (pid == 0) {
+      /* The dynamic linker only reads LD_LIBRARY_PATH at exec */
+      sweep_apply(c);
+      if (FLAGS_sqlcipher_lib != NULL) {
+        const char* path = getenv("LD_LIBRARY_PATH");
+        char* lib_path = sqlite3_mprintf("%s%s%s", FLAGS_sqlcipher_lib,
+                                         path != NULL ? ":" : "",
+                                         path != NULL ? path : "");
+        setenv("LD_LIBRARY_PATH", lib_path, 1);
+      }
+      dup2(fds[1], STDOUT_FILENO);
+      close(fds[0]);
+      close(fds[1]);
+      execv(exe, args);
+      fprintf(stderr, "exec error: %s\n", exe);
+      _exit(1);
+    }
+    close(fds[1]);
+
+    FILE* results = fdopen(fds[0], "r");
+    char line[200];
+    while (fgets(line, sizeof(line), results) != NULL) {
+      char name[32];
+      int done;
+      double micros;
+      int64_t bytes, pages, faults;
+      if (sscanf(line, "%31s %d %lf %" SCNd64 " %" SCNd64 " %" SCNd64, name,
+                 &done, &micros, &bytes, &pages, &faults) == 6) {
+        sweep_add_result(name, c, done, micros, bytes, pages, faults);
+      }
+    }
+    fclose(results);
+
+    int wstatus;
+    waitpid(pid, &wstatus, 0);
+    if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) {
+      fprintf(stderr, "sweep combination %d failed\n", c + 1);
+      exit(1);
+    }
+  }
+  free(args);
+}
+
+const char* sweep_spec() {
+  return spec_;
+}
+
+/* True if value is one of the values the sweep gives flag name */
+bool sweep_has_value(const char* name, const char* value) {
+  for (int i = 0; i < num_flags_; i++) {
+    if (strcmp(flags_[i].name_, name)) {
+      continue;
+    }
+    for (int v = 0; v < flags_[i].num_values_; v++) {
+      if (!strcmp(flags_[i].values_[v], value)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+/*
+ * Suffix that gives each combination its own database files, "" unless
+ * the combinations take turns within one process.
+ */
+void sweep_file_suffix(char* suffix, size_t size) {
+  if (!sweep_interleaved()) {
+    snprintf(suffix, size, "%s", "");
+  } else {
+    snprintf(suffix, size, ".v%d", combo_);
+  }
+}
+
+/* The last flag varies fastest */
+static void sweep_label(int combo, char* label, size_t size) {
+  int n = 0;
+  label[0] = '\0';
+  for (int i = 0; i < num_flags_; i++) {
+    int stride = 1;
+    for (int j = i + 1; j < num_flags_; j++) {
+      stride *= flags_[j].num_values_;
+    }
+    int v = (combo / stride) % flags_[i].num_values_;
+    n += snprintf(label + n, n < (int)size ? size - n : 0, "%s%s=%s",
+                  i > 0 ? " " : "", flags_[i].name_, flags_[i].values_[v]);
+  }
+}
+
+/*
+ * Set the flags of combination `combo`.  Called before each benchmark is
+ * run under that combination.
+ */
+void sweep_apply(int combo) {
+  combo_ = combo;
+  for (int i = 0; i < num_flags_; i++) {
+    int stride = 1;
+    for (int j = i + 1; j < num_flags_; j++) {
+      stride *= flags_[j].num_values_;
+    }
+    parse_flag(flags_[i].args_[(combo / stride) % flags_[i].num_values_]);
+  }
+}
+
+void sweep_print_header() {
+  if (num_flags_ == 0) {
+    return;
+  }
+
+  char label[1000];
+  sweep_label(combo_, label, sizeof(label));
+  fprintf(stderr, "Sweep %d/%d:  %s\n", combo_ + 1, num_combos_, label);
+}
+
+/*
+ * Called by stop() for every benchmark that ran.  Every combination runs
+ * the same benchmarks, so the n'th results of two combinations compare.
+ */
+void sweep_record(const char* name, int done, double micros, int64_t bytes,
+                  int64_t pages, int64_t faults) {
+  if (num_flags_ == 0) {
+    return;
+  }
+  if (FLAGS_sweep_combo >= 0) {
+    /* Picked up by sweep_run_processes() in the parent */
+    printf("%s %d %.3f %" PRId64 " %" PRId64 " %" PRId64 "\n", name, done,
+           micros, bytes, pages, faults);
+    fflush(stdout);
+    return;
+  }
+  sweep_add_result(name, combo_, done, micros, bytes, pages, faults);
+}
+
+static void sweep_add_result(const char* name, int combo, int done,
+                             double micros, int64_t bytes, int64_t pages,
+                             int64_t faults) {
+  if (num_results_ == kMaxSweepResults) {
+    return;
+  }
+
+  SweepResult* r = &results_[num_results_++];
+  snprintf(r->name_, sizeof(r->name_), "%s", name);
+  r->combo_ = combo;
+  r->slot_ = num_slots_[combo]++;
+  r->done_ = done;
+  r->micros_ = micros;
+  r->bytes_ = bytes;
+  r->pages_ = pages;
+  r->faults_ = faults;
+}
+
+/*
+ * For every benchmark of the list, one line per combination with its
+ * latency and throughput, each also as a ratio to the first combination.
+ * With --compare_plaintext that is the plaintext run, so the ratios are
+ * the overhead of encryption.  Where pages were read or written, also
+ * the time per page and the share of it above the first combination,
+ * which with --compare_hmac is the run without HMAC.  When mmap_size is
+ * swept, also the page faults per op.
+ */
+void sweep_report() {
+  if (num_flags_ == 0 || FLAGS_sweep_combo >= 0) {
+    return;
+  }
+
+  char base_label[1000];
+  sweep_label(0, base_label, sizeof(base_label));
+  fprintf(stderr, "------------------------------------------------\n");
+  fprintf(stderr, "Sweep:      %d combinations, ratios to %s\n", num_combos_,
+          base_label);
+  for (int slot = 0; slot < num_slots_[0]; slot++) {
+    double base_micros = 0, base_ops = 0, base_mbs = 0, base_page = 0;
+    for (int i = 0; i < num_results_; i++) {
+      SweepResult* r = &results_[i];
+      if (r->slot_ != slot) {
+        continue;
+      }
+      char label[1000];
+      sweep_label(r->combo_, label, sizeof(label));
+      double micros = r->micros_ / (r->done_ > 0 ? r->done_ : 1);
+      double ops = r->micros_ > 0 ? r->done_ / (r->micros_ / 1e6) : 0.0;
+      double mbs = r->micros_ > 0 ?
+          (r->bytes_ / 1048576.0) / (r->micros_ / 1e6) : 0.0;
+      double page = r->pages_ > 0 ? r->micros_ / r->pages_ : 0.0;
+      if (r->combo_ == 0) {
+        base_micros = micros;
+        base_ops = ops;
+        base_mbs = mbs;
+        base_page = page;
+      }
+      fprintf(stderr, "%-12s : %s : %.3f micros/op (%.2fx), "
+              "%.0f ops/sec (%.2fx)", r->name_, label,
+              micros, base_micros > 0 ? micros / base_micros : 0.0,
+              ops, base_ops > 0 ? ops / base_ops : 0.0);
+      if (r->bytes_ > 0) {
+        fprintf(stderr, ", %.1f MB/s (%.2fx)", mbs,
+                base_mbs > 0 ? mbs / base_mbs : 0.0);
+      }
+      if (page > 0 && base_page > 0) {
+        fprintf(stderr, ", %.3f micros/page (%+.3f, %.0f%%)", page,
+                page - base_page, 100.0 * (page - base_page) / page);
+      }
+      if (report_faults_) {
+        fprintf(stderr, ", %.3f faults/op",
+                (double)r->faults_ / (r->done_ > 0 ? r->done_ : 1));
+      }
+      fprintf(stderr, ";\n");
+    }
+  }
+}
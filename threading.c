@@ -0,0 +1,161 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "bench.h"
+
+static const char* const kThreadingModes[] = {
+  "single", "multi", "serialized"
+};
+
+/* Benchmarks that use SQLite from several threads at once */
+static const char* const kConcurrentBenchmarks[] = {
+  "fillcontend", "poolprivate", "poolshared", "integrityread"
+};
+
+/* Threading mode SQLite is currently configured with */
+static const char* mode_;
+
+static int threading_config(const char*);
+static void threading_apply(const char*);
+static const char* concurrent_use(void);
+static bool benchmark_listed(const char*);
+
+static int threading_config(const char* mode) {
+  if (!strcmp(mode, "single")) return SQLITE_CONFIG_SINGLETHREAD;
+  if (!strcmp(mode, "multi")) return SQLITE_CONFIG_MULTITHREAD;
+  return SQLITE_CONFIG_SERIALIZED;
+}
+
+/*
+ * sqlite3_config() only works while the library is shut down, so every
+ * connection must be closed before switching modes.  Initializing again
+ * resets the default VFS, which the shim then takes back.
+ */
+static void threading_apply(const char* mode) {
+  int status = sqlite3_shutdown();
+  error_check(status);
+  status = sqlite3_config(threading_config(mode));
+  if (status != SQLITE_OK) {
+    fprintf(stderr, "threading mode '%s' is not supported by this build\n",
+            mode);
+    exit(1);
+  }
+  status = sqlite3_initialize();
+  error_check(status);
+  vfsshim_restore();
+  mode_ = mode;
+}
+
+void threading_init() {
+  if (FLAGS_threading_mode != NULL) {
+    threading_apply(FLAGS_threading_mode);
+  } else {
+    /* The mode the library was compiled with */
+    mode_ = sqlite3_threadsafe() == 0 ? "single" :
+            sqlite3_threadsafe() == 2 ? "multi" : "serialized";
+  }
+
+  const char* use = concurrent_use();
+  if (!strcmp(mode_, "single") && use != NULL) {
+    fprintf(stderr, "%s runs on several threads, which single-thread mode "
+            "does not allow\n", use);
+    exit(1);
+  }
+
+  /* sqlite3_shutdown() may not run while the memdb databases are held */
+  if (storage_memdb() && benchmark_listed("threadmodes")) {
+    fprintf(stderr, "threadmodes restarts SQLite, which --storage=memdb "
+            "does not allow\n");
+    exit(1);
+  }
+}
+
+/*
+ * The first flag or benchmark that has threads other than the main one
+ * running at the same time, or NULL.  threadmodes switches to single-thread
+ * mode only for its single-threaded run.
+ */
+static const char* concurrent_use() {
+  if (FLAGS_shards > 1) return "--shards";
+  if (FLAGS_pipeline_threads > 0) return "--pipeline_threads";
+
+  const int num_benchmarks =
+      sizeof(kConcurrentBenchmarks) / sizeof(kConcurrentBenchmarks[0]);
+  for (int i = 0; i < num_benchmarks; i++) {
+    if (benchmark_listed(kConcurrentBenchmarks[i])) {
+      return kConcurrentBenchmarks[i];
+    }
+  }
+  return NULL;
+}
+
+/* True if name is one of the --benchmarks */
+static bool benchmark_listed(const char* name) {
+  const char* benchmarks = FLAGS_benchmarks;
+  while (benchmarks != NULL) {
+    const char* sep = strchr(benchmarks, ',');
+    size_t len = sep != NULL ? (size_t)(sep - benchmarks) : strlen(benchmarks);
+    if (strlen(name) == len && !strncmp(benchmarks, name, len)) {
+      return true;
+    }
+    benchmarks = sep != NULL ? sep + 1 : NULL;
+  }
+  return false;
+}
+
+const char* threading_mode() {
+  return mode_;
+}
+
+/*
+ * Connections opened in multi-thread mode skip their mutex (NOMUTEX),
+ * serialized ones keep it (FULLMUTEX).
+ */
+int threading_open_flags() {
+  if (!strcmp(mode_, "multi")) return SQLITE_OPEN_NOMUTEX;
+  if (!strcmp(mode_, "serialized")) return SQLITE_OPEN_FULLMUTEX;
+  return 0;
+}
+
+/*
+ * Run random lookups against file_name under every threading mode, first
+ * from one thread and then from FLAGS_threads threads with a connection
+ * each.  Single-thread mode is not safe with concurrent threads, so it
+ * only gets the first run.  No connection may be open when this is called.
+ */
+void threading_sweep(const char* file_name, int num_keys, int num_reads,
+                     ThreadStats* total) {
+  const char* saved = mode_;
+  memset(total, 0, sizeof(ThreadStats));
+
+  if (sqlite3_threadsafe() == 0) {
+    fprintf(stderr, "threadmodes  : SQLite was built single-threaded\n");
+    return;
+  }
+
+  const int num_modes = sizeof(kThreadingModes) / sizeof(kThreadingModes[0]);
+  for (int m = 0; m < num_modes; m++) {
+    threading_apply(kThreadingModes[m]);
+
+    int runs[2] = { 1, FLAGS_threads };
+    int num_runs = (m == 0 || FLAGS_threads == 1) ? 1 : 2;
+    for (int r = 0; r < num_runs; r++) {
+      int threads = runs[r];
+      Readers readers;
+      ThreadStats stats;
+      readers_start(&readers, file_name, threads, num_keys, num_reads);
+      readers_join(&readers, &stats);
+      fprintf(stderr, "%-12s : %d thread%s, %.3f micros/op, %.0f ops/sec;\n",
+              kThreadingModes[m], threads, threads > 1 ? "s" : "",
+              stats.micros_ * threads / (stats.done_ > 0 ? stats.done_ : 1),
+              stats.micros_ > 0 ? stats.done_ / (stats.micros_ / 1e6) : 0.0);
+      total->done_ += stats.done_;
+      total->bytes_ += stats.bytes_;
+      total->pages_ += stats.pages_;
+      total->micros_ += stats.micros_;
+    }
+  }
+
+  threading_apply(saved);
+}
@@ -3,10 +3,192 @@
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
 #include "bench.h"
-enum Order {
-    SEQUENTIAL,
-    RANDOM
-};
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+void exec_error_check(int status, char *err_msg) {
+  if (status != SQLITE_OK) {
+    fprintf(stderr, "SQL error: %s\n", err_msg);
+    sqlite3_free(err_msg);
+    exit(1);
+  }
+}
+
+void step_error_check(int status) {
+  if (status != SQLITE_DONE) {
+    fprintf(stderr, "SQL step error: status = %d\n", status);
+    exit(1);
+  }
+}
+
+void error_check(int status) {
+  if (status != SQLITE_OK) {
+    fprintf(stderr, "sqlite3 error: status = %d\n", status);
+    exit(1);
+  }
+}
+
+void wal_checkpoint(sqlite3* db_) {
+  /* Flush all writes to disk */
+  if (FLAGS_WAL_enabled) {
+    sqlite3_wal_checkpoint_v2(db_, NULL, SQLITE_CHECKPOINT_FULL, NULL,
+                              NULL);
+  }
+}
+
+/*
+ * Pages db has read from its files and written to them since it was
+ * opened or last reset, each one decrypted or encrypted once.
+ */
+int64_t db_pages(sqlite3* db, bool reset) {
+  int cur, hi;
+  int64_t pages = 0;
+  sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_MISS, &cur, &hi, reset);
+  pages += cur;
+  sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_WRITE, &cur, &hi, reset);
+  pages += cur;
+  return pages;
+}
+
+/*
+ * First column of the first row of sql, such as PRAGMA page_count.
+ */
+int64_t query_int(sqlite3* db, const char* sql) {
+  sqlite3_stmt* stmt;
+  int status = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+  error_check(status);
+
+  int64_t value = 0;
+  if ((status = sqlite3_step(stmt)) == SQLITE_ROW) {
+    value = sqlite3_column_int64(stmt, 0);
+    status = sqlite3_step(stmt);
+  }
+  step_error_check(status);
+  status = sqlite3_finalize(stmt);
+  error_check(status);
+
+  return value;
+}
+
+/*
+ * First column of the first row of sql as text, "" if there is no row.
+ * Free with sqlite3_free().
+ */
+char* query_text(sqlite3* db, const char* sql) {
+  sqlite3_stmt* stmt;
+  int status = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+  error_check(status);
+
+  char* value = NULL;
+  if ((status = sqlite3_step(stmt)) == SQLITE_ROW) {
+    const unsigned char* text = sqlite3_column_text(stmt, 0);
+    value = sqlite3_mprintf("%s", text != NULL ? (const char*)text : "");
+    status = sqlite3_step(stmt);
+  }
+  step_error_check(status);
+  status = sqlite3_finalize(stmt);
+  error_check(status);
+
+  return value != NULL ? value : sqlite3_mprintf("%s", "");
+}
+
+/*
+ * True if path names a directory.
+ */
+bool is_dir(const char* path) {
+  struct stat st;
+  return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/*
+ * Size of file_name in bytes, 0 if it does not exist.
+ */
+int64_t file_size(const char* file_name) {
+  struct stat st;
+  return stat(file_name, &st) == 0 ? (int64_t)st.st_size : 0;
+}
+
+/* Field of /proc/self/status in bytes, 0 where /proc is missing */
+static int64_t status_bytes(const char* field) {
+  FILE* status = fopen("/proc/self/status", "r");
+  if (status == NULL) {
+    return 0;
+  }
+
+  char line[200];
+  size_t len = strlen(field);
+  int64_t kb = 0;
+  while (fgets(line, sizeof(line), status) != NULL) {
+    if (!strncmp(line, field, len) && line[len] == ':' &&
+        sscanf(line + len + 1, "%" SCNd64, &kb) == 1) {
+      break;
+    }
+  }
+  fclose(status);
+  return kb * 1024;
+}
+
+/*
+ * Start measuring the peak resident set size from here: writing 5 to
+ * clear_refs resets VmHWM to the current RSS.  False where that is not
+ * allowed, and max_rss() then is the peak of the whole process.
+ */
+bool max_rss_reset() {
+  FILE* clear_refs = fopen("/proc/self/clear_refs", "w");
+  if (clear_refs == NULL) {
+    return false;
+  }
+  bool reset = fputs("5", clear_refs) >= 0;
+  return fclose(clear_refs) == 0 && reset;
+}
+
+/*
+ * Peak resident set size in bytes since max_rss_reset().
+ */
+int64_t max_rss() {
+  int64_t hwm = status_bytes("VmHWM");
+  if (hwm > 0) {
+    return hwm;
+  }
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (int64_t)usage.ru_maxrss * 1024;
+}
+
+/*
+ * Resident set size of the process in bytes now, mapped database pages
+ * included.  0 where /proc is missing.
+ */
+int64_t current_rss() {
+  return status_bytes("VmRSS");
+}
+
+/*
+ * Minor and major page faults of the process so far.  Reading a mapped
+ * page not yet in the page cache is a major fault.
+ */
+void page_faults(int64_t* minor, int64_t* major) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  *minor = usage.ru_minflt;
+  *major = usage.ru_majflt;
+}
+
+/*
+ * True if s is exactly len hex digits.
+ */
+bool is_hex(const char* s, size_t len) {
+  if (s == NULL || strlen(s) != len) {
+    return false;
+  }
+  for (size_t i = 0; i < len; i++) {
+    if (!isxdigit((unsigned char)s[i])) {
+      return false;
+    }
+  }
+
+  return true;
+}
 
 uint64_t now_micros() {
   struct timeval tv;
@@ -47,5 +229,10 @@ bool if_create_database(char* name) {
   return strcmp(name, "overwrite") && strcmp(name, "overwritesync") 
     && strcmp(name, "readseq") && strcmp(name, "readrandom") 
     && strcmp(name, "readrand100K") && strcmp(name, "delete")
-    && strcmp(name, "deletesync");
+    && strcmp(name, "deletesync") && strcmp(name, "poolprivate")
+    && strcmp(name, "poolshared") && strcmp(name, "threadmodes")
+    && strcmp(name, "openkey") && strcmp(name, "rekey")
+    && !starts_with(name, "export_") && strcmp(name, "cryptobench")
+    && strcmp(name, "integrity") && strcmp(name, "integrityread")
+    && strcmp(name, "attach");
 }
@@ -0,0 +1,283 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+/* For O_DIRECT, mincore() and posix_memalign() */
+#define _GNU_SOURCE
+#include "bench.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Reads and writes of the main database and the WAL through a second
+ * descriptor opened with O_DIRECT, so the kernel page cache holds none of
+ * their pages and SQLite's page cache is the only one.  Locking, syncs and
+ * the WAL index stay with the default VFS, see vfsshim.c.
+ */
+
+/* Offset, length and buffer alignment O_DIRECT is given */
+#define kDirectAlign 4096
+
+/*
+ * Closing any descriptor of a file drops every POSIX lock the process
+ * holds on it, the default VFS's included, so the descriptors opened here
+ * stay open and are shared by all connections to the same file.  One is
+ * only closed once its path names a new file, when the old one has been
+ * deleted.
+ */
+typedef struct DirectFd {
+  char* path_;
+  int flags_;
+  dev_t dev_;
+  ino_t ino_;
+  int fd_;
+} DirectFd;
+
+static pthread_mutex_t fds_mu_ = PTHREAD_MUTEX_INITIALIZER;
+static DirectFd* fds_ = NULL;
+static int num_fds_ = 0;
+
+static int64_t align_down(int64_t);
+static int64_t align_up(int64_t);
+static bool direct_reserve(VfsDirect*, size_t);
+static ssize_t direct_pread(int, unsigned char*, size_t, int64_t);
+
+static int64_t align_down(int64_t n) {
+  return n & ~(int64_t)(kDirectAlign - 1);
+}
+
+static int64_t align_up(int64_t n) {
+  return align_down(n + kDirectAlign - 1);
+}
+
+/*
+ * The descriptor of path opened with flags, kept open for the life of the
+ * process.  -1 with errno set if path cannot be opened that way.  Also
+ * gives vfsuring.c the descriptors it submits writes on.
+ */
+int vfsdirect_shared_fd(const char* path, int flags) {
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    return -1;
+  }
+
+  pthread_mutex_lock(&fds_mu_);
+  DirectFd* entry = NULL;
+  for (int i = 0; i < num_fds_; i++) {
+    if (fds_[i].flags_ == flags && !strcmp(fds_[i].path_, path)) {
+      entry = &fds_[i];
+      break;
+    }
+  }
+  if (entry != NULL && entry->fd_ >= 0 &&
+      (entry->dev_ != st.st_dev || entry->ino_ != st.st_ino)) {
+    close(entry->fd_);
+    entry->fd_ = -1;
+  }
+  if (entry == NULL) {
+    fds_ = realloc(fds_, sizeof(DirectFd) * (num_fds_ + 1));
+    entry = &fds_[num_fds_++];
+    entry->path_ = sqlite3_mprintf("%s", path);
+    entry->flags_ = flags;
+    entry->fd_ = -1;
+  }
+  if (entry->fd_ < 0) {
+    entry->fd_ = open(path, flags);
+    entry->dev_ = st.st_dev;
+    entry->ino_ = st.st_ino;
+  }
+  int fd = entry->fd_;
+  pthread_mutex_unlock(&fds_mu_);
+  return fd;
+}
+
+/*
+ * Open the O_DIRECT descriptor of path, which the default VFS has just
+ * opened, into d.  Exits if the file system does not take O_DIRECT.
+ */
+void vfsdirect_open(VfsDirect* d, const char* path) {
+  d->buf_ = NULL;
+  d->size_ = 0;
+  d->fd_ = vfsdirect_shared_fd(path, O_RDWR | O_DIRECT);
+  if (d->fd_ < 0) {
+    fprintf(stderr, "vfs direct: cannot open %s with O_DIRECT: %s\n",
+            path, strerror(errno));
+    exit(1);
+  }
+}
+
+void vfsdirect_close(VfsDirect* d) {
+  free(d->buf_);
+  d->buf_ = NULL;
+  d->size_ = 0;
+  d->fd_ = -1;
+}
+
+/* Grow the aligned bounce buffer of d to at least size bytes */
+static bool direct_reserve(VfsDirect* d, size_t size) {
+  if (d->size_ >= size) {
+    return true;
+  }
+  void* buf;
+  if (posix_memalign(&buf, kDirectAlign, size) != 0) {
+    return false;
+  }
+  free(d->buf_);
+  d->buf_ = buf;
+  d->size_ = size;
+  return true;
+}
+
+/* pread() until size bytes or end of file; the bytes read, -1 on error */
+static ssize_t direct_pread(int fd, unsigned char* buf, size_t size,
+                            int64_t offset) {
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = pread(fd, buf + done, size - done, offset + done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return -1;
+    }
+    if (n == 0) {
+      break;
+    }
+    done += n;
+  }
+  return done;
+}
+
+/*
+ * xRead: read the aligned blocks covering the range into the bounce
+ * buffer and copy the range out.  Past the end of file the rest is zeroed
+ * and SQLITE_IOERR_SHORT_READ returned, as SQLite expects.
+ */
+int vfsdirect_read(VfsDirect* d, void* buf, int amount, int64_t offset) {
+  int64_t start = align_down(offset);
+  size_t size = align_up(offset + amount) - start;
+  if (!direct_reserve(d, size)) {
+    return SQLITE_IOERR_NOMEM;
+  }
+  ssize_t n = direct_pread(d->fd_, d->buf_, size, start);
+  if (n < 0) {
+    return SQLITE_IOERR_READ;
+  }
+
+  int64_t avail = n - (offset - start);
+  if (avail >= amount) {
+    memcpy(buf, d->buf_ + (offset - start), amount);
+    return SQLITE_OK;
+  }
+  if (avail < 0) {
+    avail = 0;
+  }
+  memcpy(buf, d->buf_ + (offset - start), avail);
+  memset((unsigned char*)buf + avail, 0, amount - avail);
+  return SQLITE_IOERR_SHORT_READ;
+}
+
+/*
+ * xWrite: a write that does not cover whole aligned blocks reads the
+ * first and last block first and writes them back whole.  WAL frames are
+ * a page plus a 24 byte header, so every WAL write is one of those.  A
+ * write that ends mid-block past the end of file is cut back to its end.
+ */
+int vfsdirect_write(VfsDirect* d, const void* buf, int amount,
+                    int64_t offset) {
+  int64_t start = align_down(offset);
+  int64_t end = align_up(offset + amount);
+  size_t size = end - start;
+  if (!direct_reserve(d, size)) {
+    return SQLITE_IOERR_NOMEM;
+  }
+
+  int64_t file_size = -1;
+  if (start != offset || end != offset + amount) {
+    struct stat st;
+    if (fstat(d->fd_, &st) != 0) {
+      return SQLITE_IOERR_FSTAT;
+    }
+    file_size = st.st_size;
+    memset(d->buf_, 0, size);
+    if (start != offset &&
+        direct_pread(d->fd_, d->buf_, kDirectAlign, start) < 0) {
+      return SQLITE_IOERR_READ;
+    }
+    if (end != offset + amount && (start == offset || size > kDirectAlign) &&
+        direct_pread(d->fd_, d->buf_ + size - kDirectAlign, kDirectAlign,
+                     end - kDirectAlign) < 0) {
+      return SQLITE_IOERR_READ;
+    }
+  }
+  memcpy(d->buf_ + (offset - start), buf, amount);
+
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = pwrite(d->fd_, d->buf_ + done, size - done, start + done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return SQLITE_IOERR_WRITE;
+    }
+    done += n;
+  }
+
+  if (file_size >= 0 && end > file_size && end > offset + amount) {
+    int64_t new_size = offset + amount > file_size ? offset + amount
+                                                   : file_size;
+    if (ftruncate(d->fd_, new_size) != 0) {
+      return SQLITE_IOERR_TRUNCATE;
+    }
+  }
+  return SQLITE_OK;
+}
+
+/* Bytes of file_name in the kernel page cache, 0 if it does not exist */
+static int64_t cached_bytes(const char* file_name) {
+  int fd = vfsdirect_shared_fd(file_name, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+    return 0;
+  }
+
+  int64_t cached = 0;
+  long page = sysconf(_SC_PAGESIZE);
+  void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (map != MAP_FAILED) {
+    size_t num_pages = (st.st_size + page - 1) / page;
+    unsigned char* vec = malloc(num_pages);
+    if (mincore(map, st.st_size, vec) == 0) {
+      for (size_t i = 0; i < num_pages; i++) {
+        cached += vec[i] & 1;
+      }
+    }
+    free(vec);
+    munmap(map, st.st_size);
+  }
+  return cached * page;
+}
+
+/*
+ * With --vfs_direct set either way, how much memory the database takes:
+ * the RSS of the process, which holds SQLite's page cache, and the pages
+ * of the database file and its WAL in the kernel page cache.
+ */
+void vfsdirect_report(const char* name, const char* file_name) {
+  if (FLAGS_vfs_direct < 0) {
+    return;
+  }
+
+  char wal_name[1100];
+  snprintf(wal_name, sizeof(wal_name), "%s-wal", file_name);
+  int64_t rss = current_rss();
+  int64_t cached = cached_bytes(file_name) + cached_bytes(wal_name);
+  fprintf(stderr, "%-12s : %.1f MB RSS + %.1f MB database in the page cache "
+          "= %.1f MB (%s);\n", name, rss / 1048576.0, cached / 1048576.0,
+          (rss + cached) / 1048576.0,
+          FLAGS_vfs_direct ? "O_DIRECT" : "buffered");
+}
@@ -0,0 +1,645 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+/* For clock_gettime() and clock_nanosleep() */
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+#include <fcntl.h>
+
+/*
+ * A pass-through VFS over the default one.  With FLAGS_vfs_stats it counts
+ * and times file operations; with the FLAGS_vfs_*_latency and
+ * FLAGS_vfs_bandwidth flags it delays them the way slower storage would.
+ * With FLAGS_vfs_direct it reads and writes the main database and the WAL
+ * with O_DIRECT, see vfsdirect.c, and with FLAGS_vfs_uring it writes and
+ * syncs them through io_uring, see vfsuring.c.
+ */
+
+#ifndef SQLITE_OPEN_SUPER_JOURNAL
+#define SQLITE_OPEN_SUPER_JOURNAL SQLITE_OPEN_MASTER_JOURNAL
+#endif
+
+/* Files the counters are kept apart for */
+enum VfsFileKind {
+  kFileMain,
+  kFileWal,
+  kFileJournal,
+  kFileOther,
+  kNumFileKinds
+};
+
+/*
+ * Counted operations.  Shm operations belong to the WAL index.  A fetch
+ * is a page handed out from the memory map instead of read.
+ */
+enum VfsOp {
+  kOpRead,
+  kOpFetch,
+  kOpWrite,
+  kOpSync,
+  kOpTruncate,
+  kOpLock,
+  kOpShm,
+  kNumOps
+};
+
+static const char* const kFileKindNames[kNumFileKinds] = {
+  "db", "wal", "journal", "other"
+};
+
+static const char* const kOpNames[kNumOps] = {
+  "read", "fetch", "write", "sync", "truncate", "lock", "shm"
+};
+
+/* Counters shared by every connection, updated atomically */
+typedef struct VfsCounter {
+  int64_t count_;
+  int64_t bytes_;
+  int64_t nanos_;
+} VfsCounter;
+
+static VfsCounter counters_[kNumFileKinds][kNumOps];
+
+/* The wrapped file; the real one is allocated right behind it */
+typedef struct VfsFile {
+  sqlite3_file base_;
+  sqlite3_file* real_;
+  int kind_;
+  bool direct_;
+  VfsDirect dio_;
+  int uring_fd_;
+} VfsFile;
+
+static sqlite3_vfs vfs_;
+static sqlite3_vfs* real_vfs_;
+
+/* Shapes of injected delays, see vfsshim_parse_latency() */
+enum LatencyKind {
+  kLatencyNone,
+  kLatencyConstant,
+  kLatencyUniform,
+  kLatencyExponential
+};
+
+typedef struct Latency {
+  int kind_;
+  double min_micros_;
+  double max_micros_;
+} Latency;
+
+static Latency read_latency_;
+static Latency write_latency_;
+static Latency sync_latency_;
+
+/* Bandwidth cap in bytes per nanosecond, 0 for none */
+static double bytes_per_nano_;
+
+/* Transfers queue behind each other like on one device */
+static pthread_mutex_t device_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+static int64_t device_free_at_;
+
+/* Per-thread xorshift state for the delays */
+static __thread uint64_t delay_rand_;
+
+static int64_t now_nanos(void);
+static int flush(void);
+static int flush_file(VfsFile*);
+static void count(int, int, int64_t, int64_t);
+static void sleep_until(int64_t);
+static double delay_uniform(void);
+static void delay(const Latency*, int64_t);
+static bool parse_latency(const char*, Latency*);
+
+static int64_t now_nanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until(int64_t deadline) {
+  struct timespec ts;
+  ts.tv_sec = deadline / 1000000000;
+  ts.tv_nsec = deadline % 1000000000;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {}
+}
+
+/* Uniform in (0, 1] */
+static double delay_uniform() {
+  if (delay_rand_ == 0) {
+    delay_rand_ = ((uint64_t)(uintptr_t)&delay_rand_ ^ FLAGS_seed) |
+                  0x9E3779B97F4A7C15ull;
+  }
+  delay_rand_ ^= delay_rand_ << 13;
+  delay_rand_ ^= delay_rand_ >> 7;
+  delay_rand_ ^= delay_rand_ << 17;
+  return ((delay_rand_ >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * Hold the calling thread for a delay drawn from latency, plus the time
+ * bytes take through the bandwidth cap once the transfers queued before
+ * them are through.
+ */
+static void delay(const Latency* latency, int64_t bytes) {
+  double micros = 0;
+  switch (latency->kind_) {
+    case kLatencyConstant:
+      micros = latency->min_micros_;
+      break;
+    case kLatencyUniform:
+      micros = latency->min_micros_ +
+               (latency->max_micros_ - latency->min_micros_) * delay_uniform();
+      break;
+    case kLatencyExponential:
+      micros = -latency->min_micros_ * log(delay_uniform());
+      break;
+  }
+
+  int64_t deadline = now_nanos() + (int64_t)(micros * 1000);
+  if (bytes > 0 && bytes_per_nano_ > 0) {
+    pthread_mutex_lock(&device_mutex_);
+    if (device_free_at_ < deadline) {
+      device_free_at_ = deadline;
+    }
+    device_free_at_ += (int64_t)(bytes / bytes_per_nano_);
+    deadline = device_free_at_;
+    pthread_mutex_unlock(&device_mutex_);
+  }
+  if (deadline > now_nanos()) {
+    sleep_until(deadline);
+  }
+}
+
+/*
+ * Writes queued on io_uring go out before any other file operation of
+ * the thread, so none of them can observe the file without them.
+ */
+static int flush() {
+  return FLAGS_vfs_uring ? vfsuring_flush(-1) : SQLITE_OK;
+}
+
+/* Reads and sizes only wait for the queued writes to their own file */
+static int flush_file(VfsFile* f) {
+  return f->uring_fd_ >= 0 ? vfsuring_flush(f->uring_fd_) : SQLITE_OK;
+}
+
+static void count(int kind, int op, int64_t bytes, int64_t start) {
+  VfsCounter* c = &counters_[kind][op];
+  __atomic_add_fetch(&c->count_, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&c->bytes_, bytes, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&c->nanos_, now_nanos() - start, __ATOMIC_RELAXED);
+}
+
+/*
+ * sqlite3_io_methods: time the operation on the real file and count it
+ * under the kind of file it was opened as.
+ */
+static int vfs_close(sqlite3_file* file) {
+  VfsFile* f = (VfsFile*)file;
+  flush();
+  if (f->direct_) {
+    vfsdirect_close(&f->dio_);
+  }
+  return f->real_->pMethods->xClose(f->real_);
+}
+
+static int vfs_read(sqlite3_file* file, void* buf, int amount,
+                    sqlite3_int64 offset) {
+  VfsFile* f = (VfsFile*)file;
+  int64_t start = now_nanos();
+  int rc = flush_file(f);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  rc = f->direct_ ? vfsdirect_read(&f->dio_, buf, amount, offset)
+                      : f->real_->pMethods->xRead(f->real_, buf, amount,
+                                                  offset);
+  delay(&read_latency_, amount);
+  count(f->kind_, kOpRead, amount, start);
+  return rc;
+}
+
+static int vfs_write(sqlite3_file* file, const void* buf, int amount,
+                     sqlite3_int64 offset) {
+  VfsFile* f = (VfsFile*)file;
+  int64_t start = now_nanos();
+  int rc;
+  if (f->uring_fd_ >= 0) {
+    /*
+     * Queuing is a copy.  The time of the write goes to whatever submits
+     * it: the sync, another op of the thread, or the write that finds the
+     * ring full.
+     */
+    bool submits = vfsuring_full();
+    rc = vfsuring_write(f->uring_fd_, buf, amount, offset);
+    if (!submits) {
+      start = now_nanos();
+    }
+  } else if ((rc = flush()) != SQLITE_OK) {
+    return rc;
+  } else {
+    rc = f->direct_ ? vfsdirect_write(&f->dio_, buf, amount, offset)
+                    : f->real_->pMethods->xWrite(f->real_, buf, amount,
+                                                 offset);
+  }
+  delay(&write_latency_, amount);
+  count(f->kind_, kOpWrite, amount, start);
+  return rc;
+}
+
+static int vfs_truncate(sqlite3_file* file, sqlite3_int64 size) {
+  VfsFile* f = (VfsFile*)file;
+  int64_t start = now_nanos();
+  int rc = flush_file(f);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  rc = f->real_->pMethods->xTruncate(f->real_, size);
+  count(f->kind_, kOpTruncate, 0, start);
+  return rc;
+}
+
+static int vfs_sync(sqlite3_file* file, int flags) {
+  VfsFile* f = (VfsFile*)file;
+  int64_t start = now_nanos();
+  int rc;
+  if (f->uring_fd_ >= 0) {
+    rc = vfsuring_sync(f->uring_fd_);
+  } else if ((rc = flush()) != SQLITE_OK) {
+    return rc;
+  } else {
+    rc = f->real_->pMethods->xSync(f->real_, flags);
+  }
+  delay(&sync_latency_, 0);
+  count(f->kind_, kOpSync, 0, start);
+  return rc;
+}
+
+static int vfs_file_size(sqlite3_file* file, sqlite3_int64* size) {
+  VfsFile* f = (VfsFile*)file;
+  int rc = flush_file(f);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  return f->real_->pMethods->xFileSize(f->real_, size);
+}
+
+static int vfs_lock(sqlite3_file* file, int lock) {
+  VfsFile* f = (VfsFile*)file;
+  flush();
+  int64_t start = now_nanos();
+  int rc = f->real_->pMethods->xLock(f->real_, lock);
+  count(f->kind_, kOpLock, 0, start);
+  return rc;
+}
+
+static int vfs_unlock(sqlite3_file* file, int lock) {
+  VfsFile* f = (VfsFile*)file;
+  flush();
+  int64_t start = now_nanos();
+  int rc = f->real_->pMethods->xUnlock(f->real_, lock);
+  count(f->kind_, kOpLock, 0, start);
+  return rc;
+}
+
+static int vfs_check_reserved_lock(sqlite3_file* file, int* out) {
+  VfsFile* f = (VfsFile*)file;
+  flush();
+  return f->real_->pMethods->xCheckReservedLock(f->real_, out);
+}
+
+static int vfs_file_control(sqlite3_file* file, int op, void* arg) {
+  VfsFile* f = (VfsFile*)file;
+  flush();
+  return f->real_->pMethods->xFileControl(f->real_, op, arg);
+}
+
+static int vfs_sector_size(sqlite3_file* file) {
+  VfsFile* f = (VfsFile*)file;
+  return f->real_->pMethods->xSectorSize(f->real_);
+}
+
+static int vfs_device_characteristics(sqlite3_file* file) {
+  VfsFile* f = (VfsFile*)file;
+  return f->real_->pMethods->xDeviceCharacteristics(f->real_);
+}
+
+static int vfs_shm_map(sqlite3_file* file, int region, int size, int extend,
+                       void volatile** out) {
+  VfsFile* f = (VfsFile*)file;
+  flush();
+  int64_t start = now_nanos();
+  int rc = f->real_->pMethods->xShmMap(f->real_, region, size, extend, out);
+  count(kFileWal, kOpShm, 0, start);
+  return rc;
+}
+
+static int vfs_shm_lock(sqlite3_file* file, int offset, int n, int flags) {
+  VfsFile* f = (VfsFile*)file;
+  flush();
+  int64_t start = now_nanos();
+  int rc = f->real_->pMethods->xShmLock(f->real_, offset, n, flags);
+  count(kFileWal, kOpShm, 0, start);
+  return rc;
+}
+
+static void vfs_shm_barrier(sqlite3_file* file) {
+  VfsFile* f = (VfsFile*)file;
+  flush();
+  int64_t start = now_nanos();
+  f->real_->pMethods->xShmBarrier(f->real_);
+  count(kFileWal, kOpShm, 0, start);
+}
+
+static int vfs_shm_unmap(sqlite3_file* file, int delete_flag) {
+  VfsFile* f = (VfsFile*)file;
+  flush();
+  int64_t start = now_nanos();
+  int rc = f->real_->pMethods->xShmUnmap(f->real_, delete_flag);
+  count(kFileWal, kOpShm, 0, start);
+  return rc;
+}
+
+/* No memory-mapped pages from a file read with O_DIRECT */
+static int vfs_fetch(sqlite3_file* file, sqlite3_int64 offset, int amount,
+                     void** out) {
+  VfsFile* f = (VfsFile*)file;
+  if (f->direct_) {
+    *out = NULL;
+    return SQLITE_OK;
+  }
+  flush();
+  int64_t start = now_nanos();
+  int rc = f->real_->pMethods->xFetch(f->real_, offset, amount, out);
+  /*
+   * Only the mapped pages count, the others are read with xRead.  The time
+   * is the lookup; faulting the page in happens when SQLite reads it.
+   */
+  if (rc == SQLITE_OK && *out != NULL) {
+    count(f->kind_, kOpFetch, amount, start);
+  }
+  return rc;
+}
+
+static int vfs_unfetch(sqlite3_file* file, sqlite3_int64 offset, void* p) {
+  VfsFile* f = (VfsFile*)file;
+  return f->real_->pMethods->xUnfetch(f->real_, offset, p);
+}
+
+/* Version 1 for real files older than version 3, which only adds mmap */
+static const sqlite3_io_methods kMethods[2] = {
+  {
+    1,
+    vfs_close, vfs_read, vfs_write, vfs_truncate, vfs_sync, vfs_file_size,
+    vfs_lock, vfs_unlock, vfs_check_reserved_lock, vfs_file_control,
+    vfs_sector_size, vfs_device_characteristics,
+    NULL, NULL, NULL, NULL, NULL, NULL
+  },
+  {
+    3,
+    vfs_close, vfs_read, vfs_write, vfs_truncate, vfs_sync, vfs_file_size,
+    vfs_lock, vfs_unlock, vfs_check_reserved_lock, vfs_file_control,
+    vfs_sector_size, vfs_device_characteristics,
+    vfs_shm_map, vfs_shm_lock, vfs_shm_barrier, vfs_shm_unmap,
+    vfs_fetch, vfs_unfetch
+  }
+};
+
+static int vfs_open(sqlite3_vfs* vfs, const char* name, sqlite3_file* file,
+                    int flags, int* out_flags) {
+  VfsFile* f = (VfsFile*)file;
+  f->real_ = (sqlite3_file*)&f[1];
+  if (flags & SQLITE_OPEN_MAIN_DB) {
+    f->kind_ = kFileMain;
+  } else if (flags & SQLITE_OPEN_WAL) {
+    f->kind_ = kFileWal;
+  } else if (flags & (SQLITE_OPEN_MAIN_JOURNAL | SQLITE_OPEN_SUPER_JOURNAL)) {
+    f->kind_ = kFileJournal;
+  } else {
+    f->kind_ = kFileOther;
+  }
+
+  int rc = real_vfs_->xOpen(real_vfs_, name, f->real_, flags, out_flags);
+  f->direct_ = false;
+  f->uring_fd_ = -1;
+  if (f->real_->pMethods == NULL) {
+    file->pMethods = NULL;
+  } else {
+    file->pMethods = &kMethods[f->real_->pMethods->iVersion >= 3];
+    if (rc == SQLITE_OK && FLAGS_vfs_direct == 1 &&
+        (f->kind_ == kFileMain || f->kind_ == kFileWal)) {
+      vfsdirect_open(&f->dio_, name);
+      f->direct_ = true;
+    }
+    if (rc == SQLITE_OK && FLAGS_vfs_uring &&
+        (f->kind_ == kFileMain || f->kind_ == kFileWal)) {
+      f->uring_fd_ = vfsdirect_shared_fd(name, O_RDWR);
+      if (f->uring_fd_ < 0) {
+        fprintf(stderr, "vfs uring: cannot open %s\n", name);
+        exit(1);
+      }
+    }
+  }
+  return rc;
+}
+
+/* The rest of sqlite3_vfs goes straight to the real VFS */
+static int vfs_delete(sqlite3_vfs* vfs, const char* name, int sync_dir) {
+  flush();
+  return real_vfs_->xDelete(real_vfs_, name, sync_dir);
+}
+
+static int vfs_access(sqlite3_vfs* vfs, const char* name, int flags,
+                      int* out) {
+  flush();
+  return real_vfs_->xAccess(real_vfs_, name, flags, out);
+}
+
+static int vfs_full_pathname(sqlite3_vfs* vfs, const char* name, int size,
+                             char* out) {
+  return real_vfs_->xFullPathname(real_vfs_, name, size, out);
+}
+
+static void* vfs_dl_open(sqlite3_vfs* vfs, const char* name) {
+  return real_vfs_->xDlOpen(real_vfs_, name);
+}
+
+static void vfs_dl_error(sqlite3_vfs* vfs, int size, char* out) {
+  real_vfs_->xDlError(real_vfs_, size, out);
+}
+
+static void (*vfs_dl_sym(sqlite3_vfs* vfs, void* handle,
+                         const char* symbol))(void) {
+  return real_vfs_->xDlSym(real_vfs_, handle, symbol);
+}
+
+static void vfs_dl_close(sqlite3_vfs* vfs, void* handle) {
+  real_vfs_->xDlClose(real_vfs_, handle);
+}
+
+static int vfs_randomness(sqlite3_vfs* vfs, int size, char* out) {
+  return real_vfs_->xRandomness(real_vfs_, size, out);
+}
+
+static int vfs_sleep(sqlite3_vfs* vfs, int micros) {
+  return real_vfs_->xSleep(real_vfs_, micros);
+}
+
+static int vfs_current_time(sqlite3_vfs* vfs, double* out) {
+  return real_vfs_->xCurrentTime(real_vfs_, out);
+}
+
+static int vfs_get_last_error(sqlite3_vfs* vfs, int size, char* out) {
+  return real_vfs_->xGetLastError(real_vfs_, size, out);
+}
+
+static int vfs_current_time_int64(sqlite3_vfs* vfs, sqlite3_int64* out) {
+  return real_vfs_->xCurrentTimeInt64(real_vfs_, out);
+}
+
+/*
+ * Parse a delay in microseconds: "200" is always 200, "100-300" is
+ * uniform between 100 and 300, and "exp200" is exponential with a mean of
+ * 200.  Returns false if spec is none of those.
+ */
+static bool parse_latency(const char* spec, Latency* latency) {
+  double a, b;
+  char junk;
+  if (sscanf(spec, "exp%lf%c", &a, &junk) == 1 && a >= 0) {
+    latency->kind_ = kLatencyExponential;
+    latency->min_micros_ = a;
+  } else if (sscanf(spec, "%lf-%lf%c", &a, &b, &junk) == 2 && a >= 0 &&
+             b >= a) {
+    latency->kind_ = kLatencyUniform;
+    latency->min_micros_ = a;
+    latency->max_micros_ = b;
+  } else if (sscanf(spec, "%lf%c", &a, &junk) == 1 && a >= 0) {
+    latency->kind_ = kLatencyConstant;
+    latency->min_micros_ = a;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool vfsshim_parse_latency(const char* spec) {
+  Latency latency;
+  return parse_latency(spec, &latency);
+}
+
+/* True if any flag needs the shim */
+bool vfsshim_enabled() {
+  return FLAGS_vfs_stats || FLAGS_vfs_read_latency != NULL ||
+         FLAGS_vfs_write_latency != NULL || FLAGS_vfs_sync_latency != NULL ||
+         FLAGS_vfs_bandwidth > 0 || FLAGS_vfs_direct == 1 || FLAGS_vfs_uring;
+}
+
+/*
+ * Register the shim over the default VFS as the new default, so every
+ * connection opened afterwards goes through it.  Must run before the
+ * first connection to a file is opened.  sqlite3_initialize() makes the
+ * default VFS the default again, see vfsshim_restore().
+ */
+void vfsshim_init() {
+  real_vfs_ = sqlite3_vfs_find(NULL);
+  if (real_vfs_ == NULL) {
+    fprintf(stderr, "vfs shim: no default VFS\n");
+    exit(1);
+  }
+  if (FLAGS_vfs_read_latency != NULL) {
+    parse_latency(FLAGS_vfs_read_latency, &read_latency_);
+  }
+  if (FLAGS_vfs_write_latency != NULL) {
+    parse_latency(FLAGS_vfs_write_latency, &write_latency_);
+  }
+  if (FLAGS_vfs_sync_latency != NULL) {
+    parse_latency(FLAGS_vfs_sync_latency, &sync_latency_);
+  }
+  bytes_per_nano_ = FLAGS_vfs_bandwidth * 1048576.0 / 1e9;
+  if (FLAGS_vfs_uring) {
+    vfsuring_init();
+  }
+
+  vfs_.iVersion = 2;
+  vfs_.szOsFile = sizeof(VfsFile) + real_vfs_->szOsFile;
+  vfs_.mxPathname = real_vfs_->mxPathname;
+  vfs_.zName = "bench-shim";
+  vfs_.xOpen = vfs_open;
+  vfs_.xDelete = vfs_delete;
+  vfs_.xAccess = vfs_access;
+  vfs_.xFullPathname = vfs_full_pathname;
+  vfs_.xDlOpen = vfs_dl_open;
+  vfs_.xDlError = vfs_dl_error;
+  vfs_.xDlSym = vfs_dl_sym;
+  vfs_.xDlClose = vfs_dl_close;
+  vfs_.xRandomness = vfs_randomness;
+  vfs_.xSleep = vfs_sleep;
+  vfs_.xCurrentTime = vfs_current_time;
+  vfs_.xGetLastError = vfs_get_last_error;
+  vfs_.xCurrentTimeInt64 = vfs_current_time_int64;
+
+  int status = sqlite3_vfs_register(&vfs_, 1);
+  error_check(status);
+}
+
+/*
+ * Make the shim the default VFS again after sqlite3_shutdown() and
+ * sqlite3_initialize(), if vfsshim_init() has installed it.
+ */
+void vfsshim_restore() {
+  if (real_vfs_ == NULL) {
+    return;
+  }
+  int status = sqlite3_vfs_register(&vfs_, 1);
+  error_check(status);
+}
+
+void vfsshim_reset() {
+  vfsuring_reset();
+  for (int k = 0; k < kNumFileKinds; k++) {
+    for (int op = 0; op < kNumOps; op++) {
+      VfsCounter* c = &counters_[k][op];
+      __atomic_store_n(&c->count_, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&c->bytes_, 0, __ATOMIC_RELAXED);
+      __atomic_store_n(&c->nanos_, 0, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+/*
+ * One line per kind of file that saw any I/O since vfsshim_reset(): the
+ * count and total time of every operation, and the MB read and written.
+ */
+void vfsshim_report(const char* name) {
+  vfsuring_report(name);
+  if (real_vfs_ == NULL || !FLAGS_vfs_stats) {
+    return;
+  }
+
+  for (int k = 0; k < kNumFileKinds; k++) {
+    bool any = false;
+    for (int op = 0; op < kNumOps; op++) {
+      any = any || counters_[k][op].count_ > 0;
+    }
+    if (!any) {
+      continue;
+    }
+
+    fprintf(stderr, "%-12s : %-7s", name, kFileKindNames[k]);
+    const char* sep = "";
+    for (int op = 0; op < kNumOps; op++) {
+      VfsCounter* c = &counters_[k][op];
+      if (c->count_ == 0) {
+        continue;
+      }
+      fprintf(stderr, "%s %" PRId64 " %s %.3f ms", sep, c->count_,
+              kOpNames[op], c->nanos_ / 1e6);
+      if (c->bytes_ > 0) {
+        fprintf(stderr, " %.1f MB", c->bytes_ / 1048576.0);
+      }
+      sep = ",";
+    }
+    fprintf(stderr, ";\n");
+  }
+}
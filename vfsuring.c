@@ -0,0 +1,307 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+/* For syscall() and MAP_POPULATE */
+#define _GNU_SOURCE
+#include "bench.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*
+ * Writes and syncs of the main database and the WAL through io_uring,
+ * driven with the raw system calls.  xWrite only queues a copy of the
+ * data on the ring of the calling thread; xSync submits every queued
+ * write with one io_uring_enter(), linked in order to an
+ * IORING_OP_FSYNC, so the frames of a WAL commit and its sync cost one
+ * system call.  Any other file operation of the thread submits what is
+ * queued first, so SQLite never sees the file behind its own writes.
+ */
+
+/* Writes queued before a submit is forced */
+#define kUringDepth 64
+
+/* A queued write, its data at at_ in the ring's buffer */
+typedef struct UringWrite {
+  int fd_;
+  int64_t offset_;
+  size_t size_;
+  size_t at_;
+} UringWrite;
+
+typedef struct Uring {
+  int fd_;
+  void* sq_ring_;
+  size_t sq_ring_size_;
+  void* cq_ring_;
+  size_t cq_ring_size_;
+  struct io_uring_sqe* sqes_;
+  size_t sqes_size_;
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned* sq_mask_;
+  unsigned* sq_array_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned* cq_mask_;
+  struct io_uring_cqe* cqes_;
+  UringWrite writes_[kUringDepth];
+  int num_writes_;
+  unsigned char* buf_;
+  size_t buf_used_;
+  size_t buf_size_;
+} Uring;
+
+/* One ring per thread, torn down when the thread exits */
+static __thread Uring* uring_;
+static pthread_key_t uring_key_;
+
+/* Since vfsuring_reset(), over all threads */
+static int64_t submits_;
+static int64_t writes_;
+static int64_t fsyncs_;
+
+static Uring* uring_create(void);
+static void uring_destroy(void*);
+static Uring* uring_get(void);
+static int uring_submit(Uring*, int);
+
+static Uring* uring_create() {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int fd = syscall(__NR_io_uring_setup, kUringDepth + 1, &params);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  Uring* u = calloc(1, sizeof(Uring));
+  u->fd_ = fd;
+  u->sq_ring_size_ = params.sq_off.array +
+                     params.sq_entries * sizeof(unsigned);
+  u->cq_ring_size_ = params.cq_off.cqes +
+                     params.cq_entries * sizeof(struct io_uring_cqe);
+  u->sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  u->sq_ring_ = mmap(NULL, u->sq_ring_size_, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  u->cq_ring_ = mmap(NULL, u->cq_ring_size_, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  u->sqes_ = mmap(NULL, u->sqes_size_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (u->sq_ring_ == MAP_FAILED || u->cq_ring_ == MAP_FAILED ||
+      u->sqes_ == MAP_FAILED) {
+    fprintf(stderr, "vfs uring: cannot map the rings: %s\n",
+            strerror(errno));
+    exit(1);
+  }
+
+  unsigned char* sq = u->sq_ring_;
+  unsigned char* cq = u->cq_ring_;
+  u->sq_head_ = (unsigned*)(sq + params.sq_off.head);
+  u->sq_tail_ = (unsigned*)(sq + params.sq_off.tail);
+  u->sq_mask_ = (unsigned*)(sq + params.sq_off.ring_mask);
+  u->sq_array_ = (unsigned*)(sq + params.sq_off.array);
+  u->cq_head_ = (unsigned*)(cq + params.cq_off.head);
+  u->cq_tail_ = (unsigned*)(cq + params.cq_off.tail);
+  u->cq_mask_ = (unsigned*)(cq + params.cq_off.ring_mask);
+  u->cqes_ = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+  return u;
+}
+
+/* Writes still queued when a thread exits go out before the ring */
+static void uring_destroy(void* arg) {
+  Uring* u = arg;
+  if (uring_submit(u, -1) != SQLITE_OK) {
+    fprintf(stderr, "vfs uring: queued writes failed at thread exit\n");
+    exit(1);
+  }
+  munmap(u->sqes_, u->sqes_size_);
+  munmap(u->cq_ring_, u->cq_ring_size_);
+  munmap(u->sq_ring_, u->sq_ring_size_);
+  close(u->fd_);
+  free(u->buf_);
+  free(u);
+}
+
+static Uring* uring_get() {
+  if (uring_ == NULL) {
+    uring_ = uring_create();
+    if (uring_ == NULL) {
+      fprintf(stderr, "vfs uring: io_uring_setup failed: %s\n",
+              strerror(errno));
+      exit(1);
+    }
+    pthread_setspecific(uring_key_, uring_);
+  }
+  return uring_;
+}
+
+/*
+ * Submit the queued writes, and an fsync of fsync_fd after them unless it
+ * is -1, as one chain, and wait for all of it.  A failed write cancels the
+ * rest of the chain, the fsync included.
+ */
+static int uring_submit(Uring* u, int fsync_fd) {
+  int n = u->num_writes_ + (fsync_fd >= 0 ? 1 : 0);
+  if (n == 0) {
+    return SQLITE_OK;
+  }
+
+  unsigned tail = *u->sq_tail_;
+  for (int i = 0; i < n; i++) {
+    unsigned index = (tail + i) & *u->sq_mask_;
+    struct io_uring_sqe* sqe = &u->sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    if (i < u->num_writes_) {
+      UringWrite* w = &u->writes_[i];
+      sqe->opcode = IORING_OP_WRITE;
+      sqe->fd = w->fd_;
+      sqe->off = w->offset_;
+      sqe->addr = (uintptr_t)(u->buf_ + w->at_);
+      sqe->len = w->size_;
+    } else {
+      /* fdatasync(), as the unix VFS syncs on Linux */
+      sqe->opcode = IORING_OP_FSYNC;
+      sqe->fd = fsync_fd;
+      sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    }
+    if (i < n - 1) {
+      sqe->flags = IOSQE_IO_LINK;
+    }
+    sqe->user_data = i;
+    u->sq_array_[index] = index;
+  }
+  __atomic_store_n(u->sq_tail_, tail + n, __ATOMIC_RELEASE);
+
+  int rc = SQLITE_OK;
+  int reaped = 0;
+  while (reaped < n) {
+    unsigned pending = tail + n - __atomic_load_n(u->sq_head_,
+                                                  __ATOMIC_ACQUIRE);
+    int ret = syscall(__NR_io_uring_enter, u->fd_, pending, n - reaped,
+                      IORING_ENTER_GETEVENTS, NULL, 0);
+    __atomic_add_fetch(&submits_, 1, __ATOMIC_RELAXED);
+    if (ret < 0 && errno != EINTR) {
+      fprintf(stderr, "vfs uring: io_uring_enter failed: %s\n",
+              strerror(errno));
+      exit(1);
+    }
+
+    unsigned head = *u->cq_head_;
+    unsigned cq_tail = __atomic_load_n(u->cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != cq_tail; head++) {
+      struct io_uring_cqe* cqe = &u->cqes_[head & *u->cq_mask_];
+      int i = (int)cqe->user_data;
+      if (i < u->num_writes_) {
+        if (cqe->res < 0 || (size_t)cqe->res != u->writes_[i].size_) {
+          if (rc == SQLITE_OK) rc = SQLITE_IOERR_WRITE;
+        }
+      } else if (cqe->res < 0 && rc == SQLITE_OK) {
+        rc = SQLITE_IOERR_FSYNC;
+      }
+      reaped++;
+    }
+    __atomic_store_n(u->cq_head_, head, __ATOMIC_RELEASE);
+  }
+
+  __atomic_add_fetch(&writes_, u->num_writes_, __ATOMIC_RELAXED);
+  if (fsync_fd >= 0) {
+    __atomic_add_fetch(&fsyncs_, 1, __ATOMIC_RELAXED);
+  }
+  u->num_writes_ = 0;
+  u->buf_used_ = 0;
+  return rc;
+}
+
+/*
+ * Check io_uring is there before the first connection needs it.  Exits
+ * if the kernel or a seccomp filter refuses it.
+ */
+void vfsuring_init() {
+  if (FLAGS_vfs_direct == 1) {
+    fprintf(stderr, "--vfs_uring does not combine with --vfs_direct=1\n");
+    exit(1);
+  }
+  pthread_key_create(&uring_key_, uring_destroy);
+  uring_get();
+}
+
+/* xWrite: queue a copy of the data on the thread's ring */
+int vfsuring_write(int fd, const void* buf, int amount, int64_t offset) {
+  Uring* u = uring_get();
+  if (u->num_writes_ == kUringDepth) {
+    int rc = uring_submit(u, -1);
+    if (rc != SQLITE_OK) {
+      return rc;
+    }
+  }
+
+  /* Addresses are only taken at submit, so the buffer may move */
+  if (u->buf_used_ + amount > u->buf_size_) {
+    size_t size = u->buf_size_ > 0 ? u->buf_size_ : 65536;
+    while (size < u->buf_used_ + amount) {
+      size *= 2;
+    }
+    unsigned char* grown = realloc(u->buf_, size);
+    if (grown == NULL) {
+      return SQLITE_IOERR_NOMEM;
+    }
+    u->buf_ = grown;
+    u->buf_size_ = size;
+  }
+
+  UringWrite* w = &u->writes_[u->num_writes_++];
+  w->fd_ = fd;
+  w->offset_ = offset;
+  w->size_ = amount;
+  w->at_ = u->buf_used_;
+  memcpy(u->buf_ + u->buf_used_, buf, amount);
+  u->buf_used_ += amount;
+  return SQLITE_OK;
+}
+
+/* True if the next vfsuring_write() of the thread submits the queue */
+bool vfsuring_full() {
+  return uring_ != NULL && uring_->num_writes_ == kUringDepth;
+}
+
+/* xSync: the queued writes and the fsync of fd in one submission */
+int vfsuring_sync(int fd) {
+  return uring_submit(uring_get(), fd);
+}
+
+/*
+ * Submit the writes the calling thread has queued, if any are to fd or fd
+ * is -1.
+ */
+int vfsuring_flush(int fd) {
+  if (uring_ == NULL || uring_->num_writes_ == 0) {
+    return SQLITE_OK;
+  }
+  bool any = fd < 0;
+  for (int i = 0; i < uring_->num_writes_ && !any; i++) {
+    any = uring_->writes_[i].fd_ == fd;
+  }
+  return any ? uring_submit(uring_, -1) : SQLITE_OK;
+}
+
+void vfsuring_reset() {
+  __atomic_store_n(&submits_, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&writes_, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&fsyncs_, 0, __ATOMIC_RELAXED);
+}
+
+/* System calls made for the writes and syncs, per sync */
+void vfsuring_report(const char* name) {
+  if (!FLAGS_vfs_uring || submits_ == 0) {
+    return;
+  }
+
+  fprintf(stderr, "%-12s : io_uring %" PRId64 " writes, %" PRId64 " fsyncs "
+          "in %" PRId64 " submits, %.2f writes per fsync;\n", name, writes_,
+          fsyncs_, submits_,
+          fsyncs_ > 0 ? (double)writes_ / fsyncs_ : 0.0);
+}